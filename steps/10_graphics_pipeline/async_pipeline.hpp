@@ -0,0 +1,115 @@
+#pragma once
+
+#include "pipeline.hpp"
+#include "worker_pool.hpp"
+
+#include <atomic>
+#include <exception>
+#include <memory>
+#include <vector>
+
+namespace graphics
+{
+namespace vkinit
+{
+
+/*
+ * Future-like handle to a pipeline compiled on a worker thread. The render loop polls ready () every frame
+ * and keeps drawing with a pipeline it already has until the requested one shows up.
+ */
+struct pipeline_handle
+{
+    enum class status
+    {
+        pending,
+        ready,
+        failed,
+    };
+
+    bool valid () const { return static_cast<bool> (m_state); }
+    bool ready () const { return valid () && m_state->m_status.load (std::memory_order_acquire) == status::ready; }
+    bool failed () const { return valid () && m_state->m_status.load (std::memory_order_acquire) == status::failed; }
+
+    // only call once ready () has returned true
+    const graphics_pipeline_bundle &get () const { return m_state->m_bundle; }
+
+    const graphics_pipeline_bundle &get_or (const graphics_pipeline_bundle &fallback) const
+    {
+        return ready () ? get () : fallback;
+    }
+
+    // rethrows whatever the compilation threw, only call once failed () has returned true
+    void rethrow () const { std::rethrow_exception (m_state->m_error); }
+
+  private:
+    friend struct async_pipeline_builder;
+
+    struct state
+    {
+        std::atomic<status> m_status {status::pending};
+        graphics_pipeline_bundle m_bundle;
+        std::exception_ptr m_error;
+    };
+
+    std::shared_ptr<state> m_state;
+};
+
+/*
+ * Compiles graphics pipelines on a pool of worker threads. All of them go through the same VkPipelineCache,
+ * which Vulkan synchronizes internally unless it was created with
+ * VK_PIPELINE_CACHE_CREATE_EXTERNALLY_SYNCHRONIZED_BIT, and through the same (locked) shader module cache.
+ */
+struct async_pipeline_builder
+{
+    async_pipeline_builder (unsigned thread_count = vk_utils::worker_pool::default_thread_count ())
+        : m_workers {thread_count}
+    {}
+
+    /*
+     * The compilation runs after request () has returned, so the task keeps its own copy of the SPIR-V words and
+     * the caller may free the code right away. Everything else in the create info must outlive the builder: the
+     * device and caches are waited on by wait_idle (), vertex input descriptions are static in vk_utils::vertex_input.
+     */
+    pipeline_handle request (const graphics_pipeline_bundle_create_info &specification)
+    {
+        pipeline_handle handle;
+        handle.m_state = std::make_shared<pipeline_handle::state> ();
+
+        std::vector<uint32_t> vertex_words   = copy_words (specification.vertex_code);
+        std::vector<uint32_t> fragment_words = copy_words (specification.fragment_code);
+
+        m_workers.submit ([specification, vertex_words = std::move (vertex_words),
+                           fragment_words = std::move (fragment_words), state = handle.m_state] {
+            try
+            {
+                graphics_pipeline_bundle_create_info owned = specification;
+
+                owned.vertex_code   = vk_utils::spirv_code {vertex_words.data (), vertex_words.size ()};
+                owned.fragment_code = vk_utils::spirv_code {fragment_words.data (), fragment_words.size ()};
+
+                state->m_bundle = graphics_pipeline_bundle {owned};
+                state->m_status.store (pipeline_handle::status::ready, std::memory_order_release);
+            } catch ( ... )
+            {
+                state->m_error = std::current_exception ();
+                state->m_status.store (pipeline_handle::status::failed, std::memory_order_release);
+            }
+        });
+
+        return handle;
+    }
+
+    // Must be called before anything the pending requests use (device, caches) goes away
+    void wait_idle () { m_workers.wait_idle (); }
+
+  private:
+    vk_utils::worker_pool m_workers;
+
+    static std::vector<uint32_t> copy_words (vk_utils::spirv_code code)
+    {
+        return std::vector<uint32_t> (code.words, code.words + code.word_count);
+    }
+};
+
+}   // namespace vkinit
+}   // namespace graphics
@@ -0,0 +1,316 @@
+#pragma once
+
+#include "logger.hpp"
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include <vulkan/vulkan_raii.hpp>
+
+namespace graphics
+{
+namespace vkinit
+{
+
+using device_uuid = std::array<uint8_t, VK_UUID_SIZE>;
+
+// What a device can do with one particular VkSurfaceKHR
+struct surface_support
+{
+    std::vector<vk::Bool32> present;   // per queue family
+    std::vector<vk::SurfaceFormatKHR> formats;
+    std::vector<vk::PresentModeKHR> present_modes;
+};
+
+/*
+ * Everything the init stages used to ask the driver for, queried once per physical device. Feature structs
+ * are stored unchained, their pNext is always null.
+ */
+struct device_capabilities
+{
+    vk::PhysicalDeviceProperties properties;
+    device_uuid uuid {};   // zero on devices older than Vulkan 1.1
+    vk::PhysicalDeviceFeatures features;
+    vk::PhysicalDeviceVulkan12Features vulkan12_features;
+    vk::PhysicalDeviceVulkan13Features vulkan13_features;
+    std::vector<vk::ExtensionProperties> extensions;
+    std::vector<vk::QueueFamilyProperties> queue_families;
+    vk::PhysicalDeviceMemoryProperties memory;
+    // belongs to one surface, so it is filled by query_surface () and never written to disk
+    surface_support surface;
+
+    static device_capabilities query (const vk::raii::PhysicalDevice &device)
+    {
+        device_capabilities capabilities;
+        capabilities.properties = device.getProperties ();
+
+        // the *2 queries and the 1.2/1.3 feature structs only exist on devices that are new enough
+        uint32_t api_version = capabilities.properties.apiVersion;
+        capabilities.uuid    = query_uuid (device, api_version);
+
+        if ( api_version >= VK_API_VERSION_1_3 )
+        {
+            auto chain = device.getFeatures2<vk::PhysicalDeviceFeatures2, vk::PhysicalDeviceVulkan12Features,
+                                             vk::PhysicalDeviceVulkan13Features> ();
+            capabilities.features          = chain.get<vk::PhysicalDeviceFeatures2> ().features;
+            capabilities.vulkan12_features = chain.get<vk::PhysicalDeviceVulkan12Features> ();
+            capabilities.vulkan13_features = chain.get<vk::PhysicalDeviceVulkan13Features> ();
+        }
+        else if ( api_version >= VK_API_VERSION_1_2 )
+        {
+            auto chain = device.getFeatures2<vk::PhysicalDeviceFeatures2, vk::PhysicalDeviceVulkan12Features> ();
+            capabilities.features          = chain.get<vk::PhysicalDeviceFeatures2> ().features;
+            capabilities.vulkan12_features = chain.get<vk::PhysicalDeviceVulkan12Features> ();
+        }
+        else
+            capabilities.features = device.getFeatures ();
+        capabilities.vulkan12_features.pNext = nullptr;
+        capabilities.vulkan13_features.pNext = nullptr;
+
+        capabilities.extensions     = device.enumerateDeviceExtensionProperties ();
+        capabilities.queue_families = device.getQueueFamilyProperties ();
+        capabilities.memory         = device.getMemoryProperties ();
+        return capabilities;
+    }
+
+    void query_surface (const vk::raii::PhysicalDevice &device, const vk::raii::SurfaceKHR &surface_handle)
+    {
+        surface.present.resize (queue_families.size ());
+        for ( uint32_t i = 0; i < queue_families.size (); ++i )
+            surface.present[i] = device.getSurfaceSupportKHR (i, *surface_handle);
+        surface.formats       = device.getSurfaceFormatsKHR (*surface_handle);
+        surface.present_modes = device.getSurfacePresentModesKHR (*surface_handle);
+    }
+
+    static device_uuid query_uuid (const vk::raii::PhysicalDevice &device, uint32_t api_version)
+    {
+        if ( api_version < VK_API_VERSION_1_1 )
+            return {};
+        return device.getProperties2<vk::PhysicalDeviceProperties2, vk::PhysicalDeviceIDProperties> ()
+            .get<vk::PhysicalDeviceIDProperties> ()
+            .deviceUUID;
+    }
+
+    bool supports_extension (const char *name) const
+    {
+        for ( auto &extension : extensions )
+            if ( std::strcmp (extension.extensionName, name) == 0 )
+                return true;
+        return false;
+    }
+
+    // A snapshot only describes the device and driver build it was taken from
+    bool describes (const vk::PhysicalDeviceProperties &live, const device_uuid &live_uuid) const
+    {
+        if ( uuid != live_uuid || properties.vendorID != live.vendorID || properties.deviceID != live.deviceID )
+            return false;
+        return properties.driverVersion == live.driverVersion && properties.apiVersion == live.apiVersion &&
+               std::memcmp (properties.pipelineCacheUUID.data (), live.pipelineCacheUUID.data (), VK_UUID_SIZE) == 0;
+    }
+};
+
+/*
+ * Snapshots of every device seen so far, loaded from and saved to disk like the pipeline cache. A device
+ * whose snapshot is on disk only costs a vkGetPhysicalDeviceProperties and a vkGetPhysicalDeviceProperties2
+ * at startup, used to check that the device and driver haven't changed. The file stores the structs as raw
+ * bytes, so it is only valid for the Vulkan headers it was written with, and the header records their
+ * version and the struct sizes.
+ */
+struct capability_cache
+{
+    capability_cache () {}
+    explicit capability_cache (std::string path) : m_path {std::move (path)}
+    {
+        if ( m_path.empty () )
+            return;
+
+        std::ifstream file (m_path, std::ios::binary);
+        if ( !file.is_open () )
+            return;
+
+        std::vector<char> data {std::istreambuf_iterator<char> (file), std::istreambuf_iterator<char> ()};
+        if ( !deserialize (data) )
+        {
+            GRAPHICS_LOG_WARNING ("Capability cache \"" << m_path << "\" is stale or corrupt, ignoring it");
+            m_snapshots.clear ();
+            return;
+        }
+        GRAPHICS_LOG_INFO ("Loaded " << m_snapshots.size () << " device capability snapshot(s) from \"" << m_path
+                                     << "\"");
+    }
+
+    capability_cache (capability_cache &&)            = default;
+    capability_cache &operator= (capability_cache &&) = default;
+
+    // The snapshot of device, queried now if the cache doesn't have an up to date one
+    device_capabilities get (const vk::raii::PhysicalDevice &device)
+    {
+        vk::PhysicalDeviceProperties live = device.getProperties ();
+        device_uuid live_uuid             = device_capabilities::query_uuid (device, live.apiVersion);
+        for ( auto &snapshot : m_snapshots )
+            if ( snapshot.describes (live, live_uuid) )
+                return snapshot;
+
+        GRAPHICS_LOG_DEBUG ("Querying the capabilities of \"" << live.deviceName.data () << "\"");
+
+        // a driver update replaces the old snapshot of the same device
+        for ( auto it = m_snapshots.begin (); it != m_snapshots.end (); )
+            if ( it->uuid == live_uuid && it->properties.vendorID == live.vendorID &&
+                 it->properties.deviceID == live.deviceID )
+                it = m_snapshots.erase (it);
+            else
+                ++it;
+
+        m_snapshots.push_back (device_capabilities::query (device));
+        m_dirty = true;
+        return m_snapshots.back ();
+    }
+
+    // Same write-then-rename dance as pipeline_cache::save ()
+    void save () const
+    {
+        if ( !m_dirty || m_path.empty () )
+            return;
+
+        std::vector<char> data = serialize ();
+        std::string tmp_path   = m_path + ".tmp";
+        std::error_code error;
+        std::ofstream file (tmp_path, std::ios::binary | std::ios::trunc);
+        file.write (data.data (), data.size ());
+        file.close ();
+        if ( file.fail () )
+        {
+            GRAPHICS_LOG_WARNING ("Failed to write capability cache to \"" << tmp_path << "\"");
+            std::filesystem::remove (tmp_path, error);
+            return;
+        }
+
+        std::filesystem::rename (tmp_path, m_path, error);
+        if ( error )
+        {
+            GRAPHICS_LOG_WARNING ("Failed to save capability cache to \"" << m_path << "\": " << error.message ());
+            std::filesystem::remove (tmp_path, error);
+            return;
+        }
+
+        GRAPHICS_LOG_INFO ("Saved " << m_snapshots.size () << " device capability snapshot(s) to \"" << m_path
+                                    << "\"");
+    }
+
+  private:
+    static constexpr uint32_t magic   = 0x53504143;   // "CAPS"
+    static constexpr uint32_t version = 1;
+
+    std::string m_path;
+    std::vector<device_capabilities> m_snapshots;
+    bool m_dirty = false;
+
+    // fields that change whenever the layout of the stored structs might
+    static std::array<uint32_t, 10> file_header (uint32_t snapshot_count)
+    {
+        return {magic,
+                version,
+                VK_HEADER_VERSION,
+                static_cast<uint32_t> (sizeof (vk::PhysicalDeviceProperties)),
+                static_cast<uint32_t> (sizeof (vk::PhysicalDeviceFeatures)),
+                static_cast<uint32_t> (sizeof (vk::PhysicalDeviceVulkan12Features)),
+                static_cast<uint32_t> (sizeof (vk::PhysicalDeviceVulkan13Features)),
+                static_cast<uint32_t> (sizeof (vk::ExtensionProperties)),
+                static_cast<uint32_t> (sizeof (vk::PhysicalDeviceMemoryProperties)),
+                snapshot_count};
+    }
+
+    template <typename T> static void write (std::vector<char> &data, const T &value)
+    {
+        static_assert (std::is_trivially_copyable_v<T>, "Only plain structs can be stored as raw bytes");
+        const char *bytes = reinterpret_cast<const char *> (&value);
+        data.insert (data.end (), bytes, bytes + sizeof (T));
+    }
+
+    template <typename T> static void write_vector (std::vector<char> &data, const std::vector<T> &values)
+    {
+        write (data, static_cast<uint32_t> (values.size ()));
+        for ( auto &value : values )
+            write (data, value);
+    }
+
+    template <typename T> static bool read (const std::vector<char> &data, std::size_t &offset, T &value)
+    {
+        static_assert (std::is_trivially_copyable_v<T>, "Only plain structs can be stored as raw bytes");
+        if ( data.size () - offset < sizeof (T) )
+            return false;
+        std::memcpy (&value, data.data () + offset, sizeof (T));
+        offset += sizeof (T);
+        return true;
+    }
+
+    template <typename T>
+    static bool read_vector (const std::vector<char> &data, std::size_t &offset, std::vector<T> &values)
+    {
+        uint32_t count = 0;
+        if ( !read (data, offset, count) || (data.size () - offset) / sizeof (T) < count )
+            return false;
+        values.resize (count);
+        for ( auto &value : values )
+            read (data, offset, value);
+        return true;
+    }
+
+    std::vector<char> serialize () const
+    {
+        std::vector<char> data;
+        write (data, file_header (static_cast<uint32_t> (m_snapshots.size ())));
+        for ( auto &snapshot : m_snapshots )
+        {
+            write (data, snapshot.properties);
+            write (data, snapshot.uuid);
+            write (data, snapshot.features);
+            write (data, snapshot.vulkan12_features);
+            write (data, snapshot.vulkan13_features);
+            write_vector (data, snapshot.extensions);
+            write_vector (data, snapshot.queue_families);
+            write (data, snapshot.memory);
+        }
+        return data;
+    }
+
+    bool deserialize (const std::vector<char> &data)
+    {
+        std::size_t offset = 0;
+        std::array<uint32_t, 10> header {};
+        if ( !read (data, offset, header) )
+            return false;
+
+        std::array<uint32_t, 10> expected = file_header (header.back ());
+        if ( header != expected || header.back () > data.size () / sizeof (vk::PhysicalDeviceProperties) )
+            return false;
+
+        m_snapshots.resize (header.back ());
+        for ( auto &snapshot : m_snapshots )
+        {
+            bool complete = read (data, offset, snapshot.properties) && read (data, offset, snapshot.uuid) &&
+                            read (data, offset, snapshot.features) &&
+                            read (data, offset, snapshot.vulkan12_features) &&
+                            read (data, offset, snapshot.vulkan13_features) &&
+                            read_vector (data, offset, snapshot.extensions) &&
+                            read_vector (data, offset, snapshot.queue_families) && read (data, offset, snapshot.memory);
+            if ( !complete )
+                return false;
+
+            // the pointers were meaningless the moment they were written
+            snapshot.vulkan12_features.pNext = nullptr;
+            snapshot.vulkan13_features.pNext = nullptr;
+        }
+        return offset == data.size ();
+    }
+};
+
+}   // namespace vkinit
+}   // namespace graphics
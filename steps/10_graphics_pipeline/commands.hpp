@@ -0,0 +1,30 @@
+#pragma once
+
+#include <vulkan/vulkan_raii.hpp>
+
+namespace graphics
+{
+namespace vkinit
+{
+
+inline vk::raii::CommandPool make_command_pool (vk::raii::Device &device, uint32_t queue_family_index,
+                                                vk::CommandPoolCreateFlags flags = vk::CommandPoolCreateFlagBits::eTransient)
+{
+    vk::CommandPoolCreateInfo pool_info {};
+    pool_info.flags            = flags;
+    pool_info.queueFamilyIndex = queue_family_index;
+    return device.createCommandPool (pool_info);
+}
+
+inline vk::raii::CommandBuffer make_command_buffer (vk::raii::Device &device, vk::raii::CommandPool &pool,
+                                                    vk::CommandBufferLevel level = vk::CommandBufferLevel::ePrimary)
+{
+    vk::CommandBufferAllocateInfo alloc_info {};
+    alloc_info.commandPool        = *pool;
+    alloc_info.level              = level;
+    alloc_info.commandBufferCount = 1;
+    return std::move (vk::raii::CommandBuffers {device, alloc_info}.front ());
+}
+
+}   // namespace vkinit
+}   // namespace graphics
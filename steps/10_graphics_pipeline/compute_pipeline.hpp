@@ -0,0 +1,283 @@
+#pragma once
+
+#include "logger.hpp"
+#include "shaders.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <vulkan/vulkan_raii.hpp>
+
+namespace graphics
+{
+namespace vkinit
+{
+
+struct compute_pipeline_bundle_create_info
+{
+    vk::raii::Device &device;
+    vk_utils::spirv_code compute_code;
+    // descriptor set 0 of the shader, binding i holds one descriptor of type bindings[i]
+    std::vector<vk::DescriptorType> bindings;
+    // bytes of push constants, starting at offset 0
+    uint32_t push_constant_size = 0;
+    // local_size of the shader, problem sizes are divided by it to get workgroup counts
+    std::array<uint32_t, 3> workgroup_size = {64, 1, 1};
+    // descriptor sets allocate_set () can hand out before the bundle's pool runs dry
+    uint32_t max_sets = 1;
+    // every pipeline should be created through the engine's cache, nullptr disables caching
+    vk::raii::PipelineCache *pipeline_cache = nullptr;
+    // shared shader modules, nullptr makes the bundle create and drop its own
+    vk_utils::shader_module_cache *shader_cache = nullptr;
+};
+
+// Workgroups needed to cover problem_size invocations along each axis
+inline std::array<uint32_t, 3> workgroup_count (const std::array<uint32_t, 3> &problem_size,
+                                                const std::array<uint32_t, 3> &workgroup_size)
+{
+    std::array<uint32_t, 3> count;
+    for ( std::size_t i = 0; i < count.size (); ++i )
+        count[i] = (problem_size[i] + workgroup_size[i] - 1) / workgroup_size[i];
+    return count;
+}
+
+/*
+ * A compute shader together with its descriptor set layout, pipeline layout and a descriptor pool for the sets
+ * that feed it. Shaders may only use set 0, which is enough for culling, particles, post-processing and sorting
+ * passes. Fill sets with vk_utils::compute_bindings and record with dispatch ().
+ */
+struct compute_pipeline_bundle
+{
+    compute_pipeline_bundle () {}
+    compute_pipeline_bundle (const compute_pipeline_bundle_create_info &specification)
+        : m_bindings {specification.bindings}, m_push_constant_size {specification.push_constant_size},
+          m_workgroup_size {specification.workgroup_size}
+    {
+        for ( uint32_t size : m_workgroup_size )
+            if ( !size )
+                throw std::runtime_error ("Compute workgroup size can't be zero!");
+
+        // descriptor set layout
+        GRAPHICS_LOG_DEBUG ("Create Descriptor Set Layout");
+        std::vector<vk::DescriptorSetLayoutBinding> layout_bindings;
+        for ( uint32_t i = 0; i < m_bindings.size (); ++i )
+            layout_bindings.push_back (
+                vk::DescriptorSetLayoutBinding {i, m_bindings[i], 1, vk::ShaderStageFlagBits::eCompute});
+
+        vk::DescriptorSetLayoutCreateInfo set_layout_info {};
+        set_layout_info.bindingCount = static_cast<uint32_t> (layout_bindings.size ());
+        set_layout_info.pBindings    = layout_bindings.data ();
+        m_set_layout                 = specification.device.createDescriptorSetLayout (set_layout_info);
+
+        // pipeline layout
+        GRAPHICS_LOG_DEBUG ("Create Pipeline Layout");
+        vk::PushConstantRange push_constants {vk::ShaderStageFlagBits::eCompute, 0, m_push_constant_size};
+
+        vk::PipelineLayoutCreateInfo layout_info {};
+        layout_info.flags                  = vk::PipelineLayoutCreateFlags ();
+        layout_info.setLayoutCount         = 1;
+        layout_info.pSetLayouts            = &*m_set_layout;
+        layout_info.pushConstantRangeCount = m_push_constant_size ? 1 : 0;
+        layout_info.pPushConstantRanges    = m_push_constant_size ? &push_constants : nullptr;
+        m_layout                           = specification.device.createPipelineLayout (layout_info);
+
+        // compute shader
+        GRAPHICS_LOG_DEBUG ("Create compute shader module");
+        vk::raii::ShaderModule compute_shader {nullptr};
+
+        vk::ComputePipelineCreateInfo pipeline_info {};
+        pipeline_info.flags        = vk::PipelineCreateFlags ();
+        pipeline_info.stage.flags  = vk::PipelineShaderStageCreateFlags ();
+        pipeline_info.stage.stage  = vk::ShaderStageFlagBits::eCompute;
+        pipeline_info.stage.module = vk_utils::load_shader_module (specification.device, specification.shader_cache,
+                                                                   specification.compute_code, compute_shader);
+        pipeline_info.stage.pName  = "main";
+        pipeline_info.layout       = *m_layout;
+
+        // make the pipeline
+        GRAPHICS_LOG_DEBUG ("Create Compute Pipeline");
+        m_pipeline = specification.device.createComputePipeline (specification.pipeline_cache, pipeline_info);
+
+        // descriptor pool
+        if ( !m_bindings.empty () && specification.max_sets )
+        {
+            std::vector<vk::DescriptorPoolSize> pool_sizes;
+            for ( vk::DescriptorType type : m_bindings )
+            {
+                auto found = std::find_if (pool_sizes.begin (), pool_sizes.end (),
+                                           [type] (const vk::DescriptorPoolSize &size) { return size.type == type; });
+                if ( found == pool_sizes.end () )
+                    found = pool_sizes.insert (pool_sizes.end (), vk::DescriptorPoolSize {type, 0});
+                found->descriptorCount += specification.max_sets;
+            }
+
+            // vk::raii::DescriptorSet frees itself, which needs eFreeDescriptorSet
+            vk::DescriptorPoolCreateInfo pool_info {};
+            pool_info.flags         = vk::DescriptorPoolCreateFlagBits::eFreeDescriptorSet;
+            pool_info.maxSets       = specification.max_sets;
+            pool_info.poolSizeCount = static_cast<uint32_t> (pool_sizes.size ());
+            pool_info.pPoolSizes    = pool_sizes.data ();
+            m_pool                  = specification.device.createDescriptorPool (pool_info);
+        }
+    }
+
+    // A set for this pipeline from the bundle's pool, it must not outlive the bundle
+    vk::raii::DescriptorSet allocate_set (vk::raii::Device &device) const
+    {
+        if ( !*m_pool )
+            throw std::runtime_error ("Compute pipeline has no descriptor pool to allocate from!");
+
+        vk::DescriptorSetAllocateInfo set_info {};
+        set_info.descriptorPool     = *m_pool;
+        set_info.descriptorSetCount = 1;
+        set_info.pSetLayouts        = &*m_set_layout;
+        return std::move (vk::raii::DescriptorSets {device, set_info}.front ());
+    }
+
+    vk::DescriptorType binding_type (uint32_t binding) const
+    {
+        if ( binding >= m_bindings.size () )
+            throw std::runtime_error ("Compute pipeline has no binding " + std::to_string (binding) + "!");
+        return m_bindings[binding];
+    }
+
+    std::array<uint32_t, 3> workgroup_count (const std::array<uint32_t, 3> &problem_size) const
+    {
+        return vkinit::workgroup_count (problem_size, m_workgroup_size);
+    }
+
+    // Binds the pipeline and its set, null when the shader has no bindings
+    void bind (vk::raii::CommandBuffer &command_buffer, vk::DescriptorSet set = nullptr) const
+    {
+        command_buffer.bindPipeline (vk::PipelineBindPoint::eCompute, *m_pipeline);
+        if ( set )
+            command_buffer.bindDescriptorSets (vk::PipelineBindPoint::eCompute, *m_layout, 0, set, nullptr);
+    }
+
+    template <typename constants_type>
+    void push_constants (vk::raii::CommandBuffer &command_buffer, const constants_type &constants) const
+    {
+        if ( sizeof (constants_type) > m_push_constant_size )
+            throw std::runtime_error ("Push constants are bigger than the compute pipeline's range!");
+        command_buffer.pushConstants<constants_type> (*m_layout, vk::ShaderStageFlagBits::eCompute, 0, constants);
+    }
+
+    // Enough workgroups to run the shader once per element of problem_size, the shader must skip the excess
+    void dispatch (vk::raii::CommandBuffer &command_buffer, const std::array<uint32_t, 3> &problem_size) const
+    {
+        std::array<uint32_t, 3> count = workgroup_count (problem_size);
+        if ( count[0] && count[1] && count[2] )
+            command_buffer.dispatch (count[0], count[1], count[2]);
+    }
+
+    // bind () + push_constants () + dispatch () for the common case of a one-dimensional problem
+    template <typename constants_type>
+    void dispatch (vk::raii::CommandBuffer &command_buffer, vk::DescriptorSet set, const constants_type &constants,
+                   uint32_t problem_size) const
+    {
+        bind (command_buffer, set);
+        push_constants (command_buffer, constants);
+        dispatch (command_buffer, {problem_size, 1, 1});
+    }
+
+    // Workgroup counts computed on the GPU, a VkDispatchIndirectCommand at offset
+    void dispatch_indirect (vk::raii::CommandBuffer &command_buffer, vk::Buffer buffer, vk::DeviceSize offset) const
+    {
+        command_buffer.dispatchIndirect (buffer, offset);
+    }
+
+    vk::raii::DescriptorSetLayout m_set_layout {nullptr};
+    vk::raii::PipelineLayout m_layout {nullptr};
+    vk::raii::Pipeline m_pipeline {nullptr};
+    vk::raii::DescriptorPool m_pool {nullptr};
+    std::vector<vk::DescriptorType> m_bindings;
+    uint32_t m_push_constant_size           = 0;
+    std::array<uint32_t, 3> m_workgroup_size = {1, 1, 1};
+};
+
+}   // namespace vkinit
+
+namespace vk_utils
+{
+
+/*
+ * Collects the resources for one descriptor set of a compute pipeline and writes them in a single
+ * vkUpdateDescriptorSets:
+ *
+ *  vk_utils::compute_bindings {bundle, *set}.buffer (0, input).buffer (1, output).image (2, *view).update (device);
+ *
+ * The descriptor type of every binding comes from the bundle, so only the resource itself has to be given.
+ */
+struct compute_bindings
+{
+    compute_bindings (const vkinit::compute_pipeline_bundle &bundle, vk::DescriptorSet set)
+        : m_bundle {&bundle}, m_set {set}
+    {
+    }
+
+    // Storage and uniform buffers, texel buffers aren't supported
+    compute_bindings &buffer (uint32_t binding, vk::Buffer buffer, vk::DeviceSize offset = 0,
+                              vk::DeviceSize range = VK_WHOLE_SIZE)
+    {
+        vk::DescriptorType type = m_bundle->binding_type (binding);
+        if ( type != vk::DescriptorType::eStorageBuffer && type != vk::DescriptorType::eUniformBuffer &&
+             type != vk::DescriptorType::eStorageBufferDynamic && type != vk::DescriptorType::eUniformBufferDynamic )
+            throw std::runtime_error ("Binding " + std::to_string (binding) + " is a " + vk::to_string (type) +
+                                      ", not a buffer!");
+
+        m_entries.push_back (entry {binding, type, false, vk::DescriptorBufferInfo {buffer, offset, range}, {}});
+        return *this;
+    }
+
+    // Storage images have to be in eGeneral, sampled ones are usually in eShaderReadOnlyOptimal
+    compute_bindings &image (uint32_t binding, vk::ImageView view, vk::ImageLayout layout = vk::ImageLayout::eGeneral,
+                             vk::Sampler sampler = nullptr)
+    {
+        vk::DescriptorType type = m_bundle->binding_type (binding);
+        if ( type != vk::DescriptorType::eStorageImage && type != vk::DescriptorType::eSampledImage &&
+             type != vk::DescriptorType::eCombinedImageSampler )
+            throw std::runtime_error ("Binding " + std::to_string (binding) + " is a " + vk::to_string (type) +
+                                      ", not an image!");
+
+        m_entries.push_back (entry {binding, type, true, {}, vk::DescriptorImageInfo {sampler, view, layout}});
+        return *this;
+    }
+
+    void update (vk::raii::Device &device) const
+    {
+        // m_entries doesn't grow anymore, so pointers into it stay valid until the call returns
+        std::vector<vk::WriteDescriptorSet> writes;
+        writes.reserve (m_entries.size ());
+        for ( auto &entry : m_entries )
+        {
+            vk::WriteDescriptorSet write {m_set, entry.binding, 0, 1, entry.type};
+            if ( entry.is_image )
+                write.pImageInfo = &entry.image;
+            else
+                write.pBufferInfo = &entry.buffer;
+            writes.push_back (write);
+        }
+        device.updateDescriptorSets (writes, nullptr);
+    }
+
+  private:
+    struct entry
+    {
+        uint32_t binding;
+        vk::DescriptorType type;
+        bool is_image;
+        vk::DescriptorBufferInfo buffer;
+        vk::DescriptorImageInfo image;
+    };
+
+    const vkinit::compute_pipeline_bundle *m_bundle = nullptr;
+    vk::DescriptorSet m_set;
+    std::vector<entry> m_entries;
+};
+
+}   // namespace vk_utils
+}   // namespace graphics
@@ -0,0 +1,277 @@
+#pragma once
+
+#include "compute_pipeline.hpp"
+#include "dispatch.hpp"
+#include "logger.hpp"
+#include "memory.hpp"
+#include "mesh.hpp"
+#include "shaders.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <ostream>
+#include <vector>
+
+#include <vulkan/vulkan_raii.hpp>
+
+namespace graphics
+{
+namespace vk_utils
+{
+
+// Six planes as (normal, distance), a point p is inside when dot (normal, p) + distance >= 0 for all of them
+struct frustum
+{
+    std::array<std::array<float, 4>, 6> planes {};
+
+    /*
+     * Gribb-Hartmann extraction from a column-major view-projection matrix with Vulkan's 0 <= z <= w depth range.
+     * The planes are normalized, so the distance to them can be compared against a bounding sphere radius.
+     */
+    static frustum from_matrix (const std::array<float, 16> &matrix)
+    {
+        auto row = [&matrix] (int i) {
+            return std::array<float, 4> {matrix[i], matrix[4 + i], matrix[8 + i], matrix[12 + i]};
+        };
+        auto combine = [] (const std::array<float, 4> &a, const std::array<float, 4> &b, float sign) {
+            return std::array<float, 4> {a[0] + sign * b[0], a[1] + sign * b[1], a[2] + sign * b[2],
+                                         a[3] + sign * b[3]};
+        };
+
+        std::array<float, 4> x = row (0), y = row (1), z = row (2), w = row (3);
+
+        // left, right, bottom, top, near, far
+        frustum result;
+        result.planes = {combine (w, x, 1.0f), combine (w, x, -1.0f), combine (w, y, 1.0f), combine (w, y, -1.0f), z,
+                         combine (w, z, -1.0f)};
+        for ( auto &plane : result.planes )
+        {
+            float length = std::sqrt (plane[0] * plane[0] + plane[1] * plane[1] + plane[2] * plane[2]);
+            for ( auto &component : plane )
+                component /= length;
+        }
+        return result;
+    }
+
+    // Clip space itself, which is where the engine lays its objects out
+    static frustum clip_space ()
+    {
+        return from_matrix ({1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f,
+                             1.0f});
+    }
+};
+
+// Push constants of cull.comp
+struct cull_constants
+{
+    std::array<std::array<float, 4>, 6> planes;
+    uint32_t instance_count;
+    uint32_t index_count;
+};
+
+struct cull_stats
+{
+    uint64_t frames        = 0;
+    uint32_t last_visible  = 0;
+    uint32_t last_culled   = 0;
+    uint64_t total_visible = 0;
+    uint64_t total_culled  = 0;
+};
+
+/*
+ * GPU driven drawing of one mesh: every frame cull.comp tests each instance's bounding sphere against the frustum
+ * and appends a VkDrawIndexedIndirectCommand for the survivors, and the frame draws them all with a single
+ * vkCmdDrawIndexedIndirectCount. Draw and count buffers exist once per frame in flight, so a frame never writes
+ * what an earlier one may still be reading. The count is also copied into host memory, once the frame's
+ * submission has completed collect () turns it into visible/culled statistics.
+ *
+ * The record_* functions only record the work, synchronization between them is left to the render graph:
+ *      reset    - count: transfer_write
+ *      cull     - instances: storage_read, draws: storage_write, count: storage_write
+ *      readback - count: transfer_read, readback: transfer_write
+ *      draw     - draws: indirect_read, count: indirect_read, instances: vertex_buffer_read
+ */
+struct gpu_culler
+{
+    // must match local_size_x in cull.comp
+    static constexpr uint32_t workgroup_size = 64;
+
+    gpu_culler () {}
+    gpu_culler (vk::raii::Device &device, device_allocator &allocator, spirv_code cull_code, vk::Buffer instances,
+                uint32_t instance_count, uint32_t frames_in_flight, vk::raii::PipelineCache *pipeline_cache = nullptr,
+                shader_module_cache *shader_cache = nullptr)
+        : m_allocator {&allocator}, m_instances {instances}, m_instance_count {instance_count}
+    {
+        // instances, draws, count, see cull.comp
+        constexpr vk::DescriptorType storage_buffer = vk::DescriptorType::eStorageBuffer;
+
+        vkinit::compute_pipeline_bundle_create_info cull_info {
+            device,
+            cull_code,
+            {storage_buffer, storage_buffer, storage_buffer},
+            sizeof (cull_constants),
+            {workgroup_size, 1, 1},
+            frames_in_flight,
+            pipeline_cache,
+            shader_cache};
+        m_cull = vkinit::compute_pipeline_bundle {cull_info};
+
+        m_frames.reserve (frames_in_flight);
+        for ( uint32_t i = 0; i < frames_in_flight; ++i )
+            m_frames.push_back (make_frame (device));
+
+        GRAPHICS_LOG_INFO ("Culling " << instance_count << " instance(s) on the GPU");
+    }
+
+    gpu_culler (gpu_culler &&)            = default;
+    gpu_culler &operator= (gpu_culler &&) = default;
+
+    uint32_t instance_count () const { return m_instance_count; }
+
+    vk::Buffer draws (uint32_t frame) const { return **m_frames.at (frame).draws; }
+    vk::Buffer count (uint32_t frame) const { return **m_frames.at (frame).count; }
+    vk::Buffer readback (uint32_t frame) const { return **m_frames.at (frame).readback; }
+
+    void record_reset (vk::raii::CommandBuffer &command_buffer, uint32_t frame) const
+    {
+        command_buffer.fillBuffer (count (frame), 0, sizeof (uint32_t), 0);
+    }
+
+    void record_cull (vk::raii::CommandBuffer &command_buffer, uint32_t frame, const frustum &view,
+                      uint32_t index_count) const
+    {
+        cull_constants constants {view.planes, m_instance_count, index_count};
+        m_cull.dispatch (command_buffer, *m_frames.at (frame).set, constants, m_instance_count);
+    }
+
+    void record_readback (vk::raii::CommandBuffer &command_buffer, uint32_t frame)
+    {
+        command_buffer.copyBuffer (count (frame), readback (frame), vk::BufferCopy {0, 0, sizeof (uint32_t)});
+
+        // the graph has no notion of the host, so the copy is made visible to it here
+        vk::MemoryBarrier2 to_host {};
+        to_host.srcStageMask  = vk::PipelineStageFlagBits2::eTransfer;
+        to_host.srcAccessMask = vk::AccessFlagBits2::eTransferWrite;
+        to_host.dstStageMask  = vk::PipelineStageFlagBits2::eHost;
+        to_host.dstAccessMask = vk::AccessFlagBits2::eHostRead;
+
+        vk::DependencyInfo dependency_info {};
+        dependency_info.memoryBarrierCount = 1;
+        dependency_info.pMemoryBarriers    = &to_host;
+        command_buffer.pipelineBarrier2 (dependency_info);
+
+        m_frames.at (frame).pending = true;
+    }
+
+    // Binds the mesh streams followed by the instance stream, the pipeline must be bound already
+    void record_draws (vk::raii::CommandBuffer &command_buffer, uint32_t frame, const mesh &geometry) const
+    {
+        geometry.bind (command_buffer);
+        command_buffer.bindVertexBuffers (geometry.stream_count (), m_instances, vk::DeviceSize {0});
+        command_buffer.drawIndexedIndirectCount (draws (frame), 0, count (frame), 0, m_instance_count,
+                                                 sizeof (vk::DrawIndexedIndirectCommand));
+    }
+
+    // Same as above through a device_dispatch table
+    void record_draws (const device_dispatch &dispatch, vk::CommandBuffer command_buffer, uint32_t frame,
+                       const mesh &geometry) const
+    {
+        VkCommandBuffer handle = static_cast<VkCommandBuffer> (command_buffer);
+        VkBuffer instances     = static_cast<VkBuffer> (m_instances);
+        VkDeviceSize offset    = 0;
+
+        geometry.bind (dispatch, command_buffer);
+        dispatch.vkCmdBindVertexBuffers (handle, geometry.stream_count (), 1, &instances, &offset);
+        dispatch.vkCmdDrawIndexedIndirectCount (handle, static_cast<VkBuffer> (draws (frame)), 0,
+                                                static_cast<VkBuffer> (count (frame)), 0, m_instance_count,
+                                                sizeof (VkDrawIndexedIndirectCommand));
+    }
+
+    // Call once the last submission of frame has completed
+    void collect (uint32_t frame)
+    {
+        frame_resources &resources = m_frames.at (frame);
+        if ( !resources.pending )
+            return;
+        resources.pending = false;
+
+        m_allocator->invalidate (resources.readback.memory (), 0, sizeof (uint32_t));
+        uint32_t visible = 0;
+        std::memcpy (&visible, resources.readback.mapped (), sizeof (visible));
+
+        ++m_stats.frames;
+        m_stats.last_visible = visible;
+        m_stats.last_culled  = m_instance_count - visible;
+        m_stats.total_visible += m_stats.last_visible;
+        m_stats.total_culled += m_stats.last_culled;
+    }
+
+    const cull_stats &stats () const { return m_stats; }
+
+    void report (std::ostream &os) const
+    {
+        os << "GPU culling: " << m_instance_count << " instance(s)";
+        if ( m_stats.frames )
+            os << ", last frame " << m_stats.last_visible << " visible / " << m_stats.last_culled << " culled, "
+               << m_stats.total_visible / m_stats.frames << " visible / " << m_stats.total_culled / m_stats.frames
+               << " culled on average over " << m_stats.frames << " frame(s)";
+        os << std::endl;
+    }
+
+  private:
+    struct frame_resources
+    {
+        allocated_buffer draws;
+        allocated_buffer count;
+        allocated_buffer readback;
+        vk::raii::DescriptorSet set {nullptr};
+        bool pending = false;   // a readback was recorded and hasn't been collected yet
+    };
+
+    device_allocator *m_allocator = nullptr;
+    vk::Buffer m_instances;
+    uint32_t m_instance_count = 0;
+
+    vkinit::compute_pipeline_bundle m_cull;
+    std::vector<frame_resources> m_frames;   // after the bundle, the sets go back to its pool first
+    cull_stats m_stats;
+
+    frame_resources make_frame (vk::raii::Device &device)
+    {
+        frame_resources frame;
+
+        vk::BufferCreateInfo draws_info {};
+        draws_info.size        = sizeof (vk::DrawIndexedIndirectCommand) * std::max (m_instance_count, 1u);
+        draws_info.usage       = vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eIndirectBuffer;
+        draws_info.sharingMode = vk::SharingMode::eExclusive;
+        frame.draws            = m_allocator->create_buffer (draws_info, vk::MemoryPropertyFlagBits::eDeviceLocal);
+
+        vk::BufferCreateInfo count_info {};
+        count_info.size  = sizeof (uint32_t);
+        count_info.usage = vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eIndirectBuffer |
+                           vk::BufferUsageFlagBits::eTransferSrc | vk::BufferUsageFlagBits::eTransferDst;
+        count_info.sharingMode = vk::SharingMode::eExclusive;
+        frame.count            = m_allocator->create_buffer (count_info, vk::MemoryPropertyFlagBits::eDeviceLocal);
+
+        vk::BufferCreateInfo readback_info {};
+        readback_info.size        = sizeof (uint32_t);
+        readback_info.usage       = vk::BufferUsageFlagBits::eTransferDst;
+        readback_info.sharingMode = vk::SharingMode::eExclusive;
+        frame.readback            = m_allocator->create_buffer (readback_info, vk::MemoryPropertyFlagBits::eHostVisible,
+                                                                vk::MemoryPropertyFlagBits::eHostCached);
+
+        frame.set = m_cull.allocate_set (device);
+        compute_bindings {m_cull, *frame.set}
+            .buffer (0, m_instances)
+            .buffer (1, **frame.draws)
+            .buffer (2, **frame.count)
+            .update (device);
+        return frame;
+    }
+};
+
+}   // namespace vk_utils
+}   // namespace graphics
@@ -1,9 +1,12 @@
 #pragma once
 
+#include "capabilities.hpp"
 #include "logging.hpp"
 #include "queues.hpp"
 
-#include <iostream>
+#include <algorithm>
+#include <array>
+#include <cctype>
 #include <optional>
 #include <set>
 #include <string>
@@ -17,77 +20,256 @@ namespace graphics
 namespace vkinit
 {
 
-bool device_support_extensions (const vk::raii::PhysicalDevice &device,
+bool device_support_extensions (const device_capabilities &capabilities,
                                 const std::vector<const char *> &requested_extensions)
 {
     std::set<std::string> required_extensions (requested_extensions.begin (), requested_extensions.end ());
 
-    std::cout << "Device can support the folowing extensions:" << std::endl;
+    GRAPHICS_LOG_TRACE ("Device can support the folowing extensions:");
 
-    for ( auto &extension : device.enumerateDeviceExtensionProperties () )
+    for ( auto &extension : capabilities.extensions )
     {
 
-        std::cout << "\t\"" << extension.extensionName << "\"" << std::endl;
+        GRAPHICS_LOG_TRACE ("\t\"" << extension.extensionName.data () << "\"");
 
         required_extensions.erase (extension.extensionName);
     }
     return required_extensions.empty ();
 }
 
-bool is_suitable (const vk::raii::PhysicalDevice &device)
+bool is_suitable (const device_capabilities &capabilities)
 {
 
-    std::cout << "Checking if device is suitable..." << std::endl;
+    GRAPHICS_LOG_DEBUG ("Checking if device is suitable...");
 
     const std::vector<const char *> requested_extensions = {VK_KHR_SWAPCHAIN_EXTENSION_NAME};
 
-    std::cout << "We are requesting the folowwing device extensions:" << std::endl;
+    GRAPHICS_LOG_DEBUG ("We are requesting the folowwing device extensions:");
     for ( auto &extension : requested_extensions )
-        std::cout << "\t\"" << extension << "\"" << std::endl;
+        GRAPHICS_LOG_DEBUG ("\t\"" << extension << "\"");
 
-    if ( !device_support_extensions (device, requested_extensions) )
+    if ( !device_support_extensions (capabilities, requested_extensions) )
     {
 
-        std::cout << "Device can't support all the requested extensions!" << std::endl;
+        GRAPHICS_LOG_WARNING ("Device can't support all the requested extensions!");
 
         return false;
     }
 
-    std::cout << "Device can support all the requested extensions!" << std::endl;
+    GRAPHICS_LOG_DEBUG ("Device can support all the requested extensions!");
+
+    // frames, uploads and deferred deletion are tracked with timeline semaphores, the render graph records
+    // synchronization2 barriers
+    if ( capabilities.properties.apiVersion < VK_API_VERSION_1_3 )
+    {
+
+        GRAPHICS_LOG_WARNING ("Device doesn't support Vulkan 1.3!");
+
+        return false;
+    }
+
+    if ( !capabilities.vulkan12_features.timelineSemaphore )
+    {
+
+        GRAPHICS_LOG_WARNING ("Device can't support timeline semaphores!");
+
+        return false;
+    }
+
+    if ( !capabilities.vulkan13_features.synchronization2 )
+    {
+
+        GRAPHICS_LOG_WARNING ("Device can't support synchronization2!");
+
+        return false;
+    }
 
     return true;
 }
 
-vk::raii::PhysicalDevice choose_phys_device (const vk::raii::Instance &instance)
+// Optional features behind vk_utils::gpu_culler, every draw it writes points firstInstance at its object
+bool supports_gpu_culling (const device_capabilities &capabilities)
 {
+    return capabilities.features.multiDrawIndirect && capabilities.features.drawIndirectFirstInstance &&
+           capabilities.vulkan12_features.drawIndirectCount;
+}
 
-    std::cout << "Choosing physical device..." << std::endl;
-
-    std::vector<vk::raii::PhysicalDevice> available_devices = instance.enumeratePhysicalDevices ();
+// 32 hex digits, dashes are ignored, so both the canonical 8-4-4-4-12 form and a plain dump work
+std::optional<device_uuid> parse_device_uuid (const std::string &text)
+{
+    device_uuid uuid {};
+    std::size_t digits = 0;
+    for ( char c : text )
+    {
+        if ( c == '-' )
+            continue;
+        if ( !std::isxdigit (static_cast<unsigned char> (c)) || digits == 2 * VK_UUID_SIZE )
+            return std::nullopt;
+
+        unsigned char digit = static_cast<unsigned char> (c);
+        int value           = std::isdigit (digit) ? digit - '0' : std::tolower (digit) - 'a' + 10;
+        uuid[digits / 2] |= static_cast<uint8_t> (digits % 2 ? value : value << 4);
+        ++digits;
+    }
+    if ( digits != 2 * VK_UUID_SIZE )
+        return std::nullopt;
+    return uuid;
+}
 
-    std::cout << "There are " << available_devices.size () << " available physical device(s) on this system"
-              << std::endl;
+std::string to_string (const device_uuid &uuid)
+{
+    static const char hex[] = "0123456789abcdef";
 
-    for ( auto &device : available_devices )
+    std::string result;
+    for ( std::size_t i = 0; i < uuid.size (); ++i )
     {
+        if ( i == 4 || i == 6 || i == 8 || i == 10 )
+            result += '-';
+        result += hex[uuid[i] >> 4];
+        result += hex[uuid[i] & 0xf];
+    }
+    return result;
+}
+
+struct device_preferences
+{
+    // pins a device regardless of its score, e.g. to benchmark the integrated GPU of a hybrid system
+    std::optional<device_uuid> uuid;
+};
+
+/*
+ * Higher is better. The device type dominates, so a discrete GPU always wins over an integrated one or a
+ * CPU implementation like llvmpipe, the rest orders devices of the same type: device local memory, queue
+ * families we can overlap work on, and features and limits the renderer benefits from.
+ */
+uint64_t score_device (const device_capabilities &capabilities)
+{
+    const vk::PhysicalDeviceProperties &properties = capabilities.properties;
 
-        log_device_properties (device);
+    uint64_t type_score = 0;
+    switch ( properties.deviceType )
+    {
+    case vk::PhysicalDeviceType::eDiscreteGpu:
+        type_score = 100000;
+        break;
+    case vk::PhysicalDeviceType::eIntegratedGpu:
+        type_score = 40000;
+        break;
+    case vk::PhysicalDeviceType::eVirtualGpu:
+        type_score = 20000;
+        break;
+    case vk::PhysicalDeviceType::eCpu:
+        type_score = 1000;
+        break;
+    default:
+        break;
+    }
 
-        if ( is_suitable (device) )
-            return device;
+    // the largest device local heap in MiB / 16, capped at 32 GiB so memory never outweighs the device type
+    const vk::PhysicalDeviceMemoryProperties &memory = capabilities.memory;
+    vk::DeviceSize largest_heap                      = 0;
+    for ( uint32_t i = 0; i < memory.memoryHeapCount; ++i )
+        if ( memory.memoryHeaps[i].flags & vk::MemoryHeapFlagBits::eDeviceLocal )
+            largest_heap = std::max (largest_heap, memory.memoryHeaps[i].size);
+    uint64_t memory_score = std::min<vk::DeviceSize> (largest_heap, 32ull << 30) >> 24;
+
+    // the same dedicated families find_queue_families () looks for
+    bool dedicated_transfer = false, dedicated_compute = false;
+    for ( auto &family : capabilities.queue_families )
+    {
+        bool graphics = static_cast<bool> (family.queueFlags & vk::QueueFlagBits::eGraphics);
+        bool compute  = static_cast<bool> (family.queueFlags & vk::QueueFlagBits::eCompute);
+        bool transfer = static_cast<bool> (family.queueFlags & vk::QueueFlagBits::eTransfer);
+        dedicated_transfer |= transfer && !graphics && !compute;
+        dedicated_compute |= compute && !graphics;
     }
+    uint64_t queue_score = (dedicated_transfer ? 500 : 0) + (dedicated_compute ? 500 : 0);
+
+    const vk::PhysicalDeviceFeatures &core = capabilities.features;
 
-    return nullptr;
+    uint64_t feature_score = 0;
+    feature_score += core.multiDrawIndirect ? 200 : 0;
+    feature_score += core.drawIndirectFirstInstance ? 100 : 0;
+    feature_score += core.samplerAnisotropy ? 100 : 0;
+    feature_score += capabilities.vulkan12_features.drawIndirectCount ? 300 : 0;
+    feature_score += properties.limits.timestampComputeAndGraphics ? 100 : 0;
+    feature_score += properties.limits.maxImageDimension2D / 1024;
+    feature_score += std::min<uint64_t> (properties.limits.maxPushConstantsSize, 256) / 16;
+
+    uint64_t score = type_score + memory_score + queue_score + feature_score;
+
+    GRAPHICS_LOG_DEBUG ("Device \"" << properties.deviceName.data () << "\" scores " << score << " (type "
+                                   << type_score << ", memory " << memory_score << ", queues " << queue_score
+                                   << ", features " << feature_score << ")");
+
+    return score;
 }
 
-vk::raii::Device create_logical_device (vk::raii::PhysicalDevice &p_device, vk::raii::SurfaceKHR &surface)
+// Snapshots come from the cache, so with a warm cache choosing queries little more than the device list
+vk::raii::PhysicalDevice choose_phys_device (const vk::raii::Instance &instance, capability_cache &cache,
+                                             const device_preferences &preferences = {})
 {
-    queue_family_indices indices = find_queue_families (p_device, surface);
 
-    std::vector<uint32_t> unique_indices;
-    unique_indices.push_back (indices.graphics_family.value ());
-    if ( indices.graphics_family.value () != indices.present_family.value () )
-        unique_indices.push_back (indices.present_family.value ());
+    GRAPHICS_LOG_INFO ("Choosing physical device...");
+
+    std::vector<vk::raii::PhysicalDevice> available_devices = instance.enumeratePhysicalDevices ();
+
+    GRAPHICS_LOG_INFO ("There are " << available_devices.size () << " available physical device(s) on this system");
+
+    std::size_t best    = available_devices.size ();
+    uint64_t best_score = 0;
+    bool found_pinned   = false;
+    std::string best_name;
+    for ( std::size_t i = 0; i < available_devices.size (); ++i )
+    {
+        vk::raii::PhysicalDevice &device  = available_devices[i];
+        device_capabilities capabilities = cache.get (device);
+
+        log_device_properties (capabilities.properties);
+
+        const device_uuid &uuid = capabilities.uuid;
+        GRAPHICS_LOG_DEBUG ("Device UUID: " << to_string (uuid));
+        bool pinned = preferences.uuid && *preferences.uuid == uuid;
+        found_pinned |= pinned;
+
+        if ( !is_suitable (capabilities) )
+        {
+            if ( pinned )
+                GRAPHICS_LOG_WARNING ("Pinned device " << to_string (uuid) << " isn't suitable, ignoring the pin");
+            continue;
+        }
+
+        if ( pinned )
+        {
+            GRAPHICS_LOG_INFO ("Using pinned device " << to_string (uuid));
+            return std::move (device);
+        }
+
+        uint64_t score = score_device (capabilities);
+        if ( best == available_devices.size () || score > best_score )
+        {
+            best       = i;
+            best_score = score;
+            best_name  = capabilities.properties.deviceName.data ();
+        }
+    }
+
+    if ( preferences.uuid && !found_pinned )
+        GRAPHICS_LOG_WARNING ("No device has the pinned UUID " << to_string (*preferences.uuid));
+
+    if ( best == available_devices.size () )
+        return nullptr;
+
+    GRAPHICS_LOG_INFO ("Picked \"" << best_name << "\" with score " << best_score);
+    return std::move (available_devices[best]);
+}
+
+// Device layers are deprecated, they are only passed for implementations older than Vulkan 1.0.13
+vk::raii::Device create_logical_device (vk::raii::PhysicalDevice &p_device, const queue_family_indices &indices,
+                                        const device_capabilities &capabilities, bool validation = false)
+{
+    // one queue on every family we use, the dedicated transfer/compute ones included
+    std::vector<uint32_t> unique_indices = indices.unique_families ();
 
     float queue_priority = 1.0f;
     std::vector<vk::DeviceQueueCreateInfo> queue_create_info;
@@ -98,9 +280,25 @@ vk::raii::Device create_logical_device (vk::raii::PhysicalDevice &p_device, vk::
     std::vector<const char *> device_extensions = {VK_KHR_SWAPCHAIN_EXTENSION_NAME};
 
     vk::PhysicalDeviceFeatures device_features {};   // default setup
+
+    vk::PhysicalDeviceVulkan13Features vulkan13_features {};
+    vulkan13_features.synchronization2 = VK_TRUE;
+
+    vk::PhysicalDeviceVulkan12Features vulkan12_features {};
+    vulkan12_features.pNext             = &vulkan13_features;
+    vulkan12_features.timelineSemaphore = VK_TRUE;
+
+    // enabled whenever they are there, the engine falls back to CPU draws without them
+    if ( supports_gpu_culling (capabilities) )
+    {
+        device_features.multiDrawIndirect         = VK_TRUE;
+        device_features.drawIndirectFirstInstance = VK_TRUE;
+        vulkan12_features.drawIndirectCount       = VK_TRUE;
+    }
     std::vector<const char *> enabled_layers;
 
-    enabled_layers.push_back ("VK_LAYER_KHRONOS_validation");
+    if ( validation )
+        enabled_layers.push_back ("VK_LAYER_KHRONOS_validation");
 
     // clang-format off
     vk::DeviceCreateInfo device_create_info {
@@ -113,17 +311,18 @@ vk::raii::Device create_logical_device (vk::raii::PhysicalDevice &p_device, vk::
         device_extensions.data(),
         &device_features};
     // clang-format on
+    device_create_info.pNext = &vulkan12_features;
     try
     {
         vk::raii::Device device = p_device.createDevice (device_create_info);
 
-        std::cout << "GPU has been successfully abstracted!" << std::endl;
+        GRAPHICS_LOG_INFO ("GPU has been successfully abstracted!");
 
         return device;
     } catch ( vk::SystemError &err )
     {
 
-        std::cout << "Device creation failed!" << std::endl;
+        GRAPHICS_LOG_ERROR ("Device creation failed: " << err.what ());
 
         return nullptr;
     }
@@ -136,17 +335,29 @@ vk::SurfaceKHR create_surface (vk::raii::Instance &instance, GLFWwindow *window)
     if ( res != VK_SUCCESS )
     {
 
-        std::cout << "Failed to abstract the glfw surface for Vulkan! ERRCODE: " << res << std::endl;
+        GRAPHICS_LOG_ERROR ("Failed to abstract the glfw surface for Vulkan! ERRCODE: " << res);
 
         throw std::runtime_error ("Failed to abstract the glfw surface for Vulkan!");
     }
     else
     {
 
-        std::cout << "Successfully abstracted the glfw surface for Vulkan!" << std::endl;
+        GRAPHICS_LOG_INFO ("Successfully abstracted the glfw surface for Vulkan!");
     }
     return c_style_surface;
 }
 
+vk::raii::SurfaceKHR create_headless_surface (vk::raii::Instance &instance)
+{
+    vk::HeadlessSurfaceCreateInfoEXT create_info {};
+    create_info.flags = vk::HeadlessSurfaceCreateFlagsEXT ();
+
+    vk::raii::SurfaceKHR surface {instance, create_info};
+
+    GRAPHICS_LOG_INFO ("Successfully made a headless surface for Vulkan!");
+
+    return surface;
+}
+
 }   // namespace vkinit
 }   // namespace graphics
\ No newline at end of file
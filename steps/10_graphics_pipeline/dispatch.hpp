@@ -0,0 +1,55 @@
+#pragma once
+
+#include <stdexcept>
+#include <string>
+
+#include <vulkan/vulkan_raii.hpp>
+
+namespace graphics
+{
+namespace vk_utils
+{
+
+// The commands the engine records its draws with, everything else stays on the vk::raii objects
+#define GRAPHICS_DEVICE_DISPATCH_COMMANDS(command)                                                                     \
+    command (vkCmdBindPipeline)                                                                                        \
+    command (vkCmdBindVertexBuffers)                                                                                   \
+    command (vkCmdBindIndexBuffer)                                                                                     \
+    command (vkCmdPushConstants)                                                                                       \
+    command (vkCmdSetViewport)                                                                                         \
+    command (vkCmdSetScissor)                                                                                          \
+    command (vkCmdDrawIndexed)                                                                                         \
+    command (vkCmdDrawIndexedIndirectCount)
+
+/*
+ * One flat table of device-level function pointers, loaded through vkGetDeviceProcAddr like volk does. The
+ * exported vkCmd* symbols go through the loader's trampolines, which look the dispatch table up from the handle
+ * on every call. vk::raii already skips those, but reaches its table through a pointer stored in every wrapper
+ * object, and its ArrayProxy and error checking sit on top. Calls through this table go straight into the
+ * driver with the raw handles. Only valid for the device it was loaded from.
+ */
+struct device_dispatch
+{
+#define GRAPHICS_DECLARE_DEVICE_COMMAND(name) PFN_##name name = nullptr;
+    GRAPHICS_DEVICE_DISPATCH_COMMANDS (GRAPHICS_DECLARE_DEVICE_COMMAND)
+#undef GRAPHICS_DECLARE_DEVICE_COMMAND
+
+    device_dispatch () {}
+    explicit device_dispatch (const vk::raii::Device &device)
+    {
+        PFN_vkGetDeviceProcAddr get_proc_address = device.getDispatcher ()->vkGetDeviceProcAddr;
+        VkDevice handle                          = static_cast<VkDevice> (*device);
+
+#define GRAPHICS_LOAD_DEVICE_COMMAND(name)                                                                             \
+    name = reinterpret_cast<PFN_##name> (get_proc_address (handle, #name));                                            \
+    if ( !name )                                                                                                       \
+        throw std::runtime_error (std::string {"Failed to load "} + #name);
+        GRAPHICS_DEVICE_DISPATCH_COMMANDS (GRAPHICS_LOAD_DEVICE_COMMAND)
+#undef GRAPHICS_LOAD_DEVICE_COMMAND
+    }
+
+    bool loaded () const { return vkCmdDrawIndexed != nullptr; }
+};
+
+}   // namespace vk_utils
+}   // namespace graphics
@@ -1,69 +1,353 @@
 #pragma once
 
+#include "async_pipeline.hpp"
+#include "capabilities.hpp"
+#include "commands.hpp"
+#include "compute_pipeline.hpp"
+#include "culling.hpp"
 #include "device.hpp"
+#include "dispatch.hpp"
+#include "framebuffer.hpp"
 #include "frames.hpp"
 #include "instance.hpp"
+#include "logger.hpp"
 #include "logging.hpp"
+#include "memory.hpp"
+#include "mesh.hpp"
 #include "pipeline.hpp"
+#include "pipeline_cache.hpp"
+#include "profiler.hpp"
+#include "recording.hpp"
+#include "render_graph.hpp"
+#include "staging.hpp"
 #include "swapchain.hpp"
+#include "sync.hpp"
+#include "timeline.hpp"
+#include "validation.hpp"
+
+#include "shaders/cull_spv.hpp"
+#include "shaders/fragment_spv.hpp"
+#include "shaders/instanced_vertex_spv.hpp"
+#include "shaders/vertex_spv.hpp"
 
 #include <vulkan/vulkan_raii.hpp>
 
 #include <GLFW/glfw3.h>
 
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
 #include <iostream>
+#include <memory>
+#include <optional>
+#include <tuple>
+#include <vector>
 
 namespace graphics
 {
 
+struct engine_create_info
+{
+    uint32_t width                = 800;
+    uint32_t height               = 600;
+    uint32_t max_frames_in_flight = 2;
+    // render without GLFW through VK_EXT_headless_surface, e.g. on lavapipe
+    bool headless = false;
+    // stop after this many frames, 0 means run until the window is closed
+    uint64_t frame_limit = 0;
+    // loaded at startup and written back at shutdown, an empty path disables the on-disk cache
+    std::string pipeline_cache_path = "pipeline_cache.bin";
+    // device capability snapshots, an empty path queries the driver on every startup
+    std::string capability_cache_path = "device_capabilities.bin";
+    vkinit::present_policy present_policy = vkinit::present_policy::low_latency;
+    // staging memory each frame in flight may upload through
+    vk::DeviceSize staging_buffer_size = 16ull << 20;
+    // feed positions and colors as separate vertex streams instead of one interleaved stream
+    bool split_vertex_streams = false;
+    // copies of the mesh drawn on a grid, one draw call each
+    uint32_t object_count = 1;
+    // threads recording the draw list into secondary command buffers, 0 records everything on the render thread
+    uint32_t recording_threads = 0;
+    // record all draws through a flat table of device-level function pointers, see vk_utils::device_dispatch
+    bool direct_dispatch = false;
+    // cull the objects against the frustum in a compute shader and draw the survivors with one
+    // vkCmdDrawIndexedIndirectCount, ignored on devices without the indirect draw features it needs
+    bool gpu_culling = false;
+    // use this physical device instead of the best scoring one, see vkinit::parse_device_uuid ()
+    std::optional<vkinit::device_uuid> device_uuid;
+    // load VK_LAYER_KHRONOS_validation and route its messages through a validation_filter
+    bool validation = false;
+    vk_utils::validation_settings validation_settings;
+};
+
 struct engine
 {
   public:
-    engine ()
+    engine (const engine_create_info &info = {})
+        : width {info.width}, height {info.height}, headless {info.headless}, frame_limit {info.frame_limit},
+          staging_buffer_size {info.staging_buffer_size}, split_vertex_streams {info.split_vertex_streams},
+          object_count {std::max (info.object_count, 1u)}, present_policy {info.present_policy},
+          recording_threads {info.recording_threads}, max_frames_in_flight {std::max (info.max_frames_in_flight, 1u)}
     {
+        startup.restart ();
 
-        std::cout << "Making a graphics engine..." << std::endl;
+        GRAPHICS_LOG_INFO ("Making a graphics engine...");
+
+        if ( !headless )
+        {
+            build_glfw_window ();
+            startup.mark ("window");
+        }
+        instance = vkinit::make_instance ("first instance", headless, info.validation);
+        startup.mark ("instance");
 
-        build_glfw_window ();
-        instance = vkinit::make_instance ("first instance");
+        if ( info.validation )
+        {
+            validation      = std::make_unique<vk_utils::validation_filter> (info.validation_settings);
+            debug_messenger = vkinit::make_debug_messenger (instance, *validation);
+            startup.mark ("debug messenger");
+        }
+
+        {
+            vkinit::capability_cache capability_cache {info.capability_cache_path};
+            phys_device =
+                vkinit::choose_phys_device (instance, capability_cache, vkinit::device_preferences {info.device_uuid});
+            capabilities = capability_cache.get (phys_device);
+            capability_cache.save ();
+        }
+        startup.mark ("physical device");
+        if ( headless )
+            surface = std::make_unique<vk::raii::SurfaceKHR> (vkinit::create_headless_surface (instance));
+        else
+            surface = std::make_unique<vk::raii::SurfaceKHR> (instance, vkinit::create_surface (instance, window));
+        capabilities.query_surface (phys_device, *surface);
+        startup.mark ("surface");
+        // every later stage reads the snapshot instead of asking the driver again
+        vkinit::queue_family_indices families = vkinit::find_queue_families (capabilities);
+        device = vkinit::create_logical_device (phys_device, families, capabilities, info.validation);
+        if ( info.direct_dispatch )
+            dispatch = vk_utils::device_dispatch {device};
+        startup.mark ("device");
+        queues    = vkinit::get_queues (device, families);
+        timelines = std::make_unique<vk_utils::device_timelines> (device, queues);
+        startup.mark ("queues");
+        allocator = std::make_unique<vk_utils::device_allocator> (device, capabilities.properties, capabilities.memory);
+        startup.mark ("allocator");
+        GRAPHICS_LOG_INFO ("Transfer queue is "
+                           << (queues.dedicated_transfer () ? "dedicated" : "shared with graphics")
+                           << ", compute queue is "
+                           << (queues.dedicated_compute () ? "dedicated" : "shared with graphics"));
+        swapchain = vkinit::create_swapchain (device, phys_device, *surface, capabilities, queues.families, width,
+                                              height, present_policy);
+        startup.mark ("swapchain");
 
-        vkinit::make_debug_messenger (instance);
+        pipeline_cache = vkinit::pipeline_cache {device, capabilities.properties, info.pipeline_cache_path};
+        startup.mark ("pipeline cache");
 
-        phys_device    = vkinit::choose_phys_device (instance);
-        surface        = std::make_unique<vk::raii::SurfaceKHR> (instance, vkinit::create_surface (instance, window));
-        device         = vkinit::create_logical_device (phys_device, *surface);
-        auto queues    = vkinit::get_queue (phys_device, device, *surface);
-        graphics_queue = queues[0];
-        present_queue  = queues[1];
-        vkinit::query_swapchain_support (phys_device, *surface);
-        swapchain = vkinit::create_swapchain (device, phys_device, *surface, width, height);
+        gpu_culling = info.gpu_culling && vkinit::supports_gpu_culling (capabilities);
+        if ( info.gpu_culling && !gpu_culling )
+            GRAPHICS_LOG_WARNING ("Device can't draw indirect with a count, drawing every object from the CPU instead");
 
         vkinit::graphics_pipeline_bundle_create_info pipeline_info {
-            device, "shaders/vertex.spv", "shaders/fragment.spv", swapchain.m_extent, swapchain.m_format};
+            device,
+            gpu_culling ? vk_utils::as_spirv (shaders::instanced_vertex_spv) : vk_utils::as_spirv (shaders::vertex_spv),
+            vk_utils::as_spirv (shaders::fragment_spv),
+            swapchain.m_format,
+            &pipeline_cache.m_impl,
+            &shader_cache,
+            vertex_input (),
+            draw_mode ()};
         pipeline_bundle = vkinit::graphics_pipeline_bundle {pipeline_info};
+        startup.mark ("pipeline");
+
+        vkinit::make_framebuffers (device, pipeline_bundle.m_renderpass, swapchain.m_extent, swapchain.m_frames);
+        startup.mark ("framebuffers");
+        make_frames ();
+        startup.mark ("frames");
+        make_meshes ();
+        startup.mark ("meshes");
+        build_render_graph ();
+        startup.mark ("render graph");
     }
+    engine (const engine &)             = delete;
+    engine &operator= (const engine &) = delete;
+
     ~engine ()
     {
 
-        std::cout << "Destroing graphics engine..." << std::endl;
-        glfwTerminate ();
+        GRAPHICS_LOG_INFO ("Destroing graphics engine...");
+        if ( *device )
+            device.waitIdle ();
+        if ( pipeline_builder )
+            pipeline_builder->wait_idle ();
+        pipeline_cache.save ();
+        if ( !headless )
+            glfwTerminate ();
+    }
+
+    void run ()
+    {
+        auto start = std::chrono::steady_clock::now ();
+
+        while ( !should_close () )
+        {
+            if ( !headless )
+                glfwPollEvents ();
+            if ( draw_frame () )
+                ++frame_number;
+        }
+        device.waitIdle ();
+
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now () - start;
+        GRAPHICS_LOG_INFO ("Rendered " << frame_number << " frame(s) in " << elapsed.count () << " s ("
+                                       << frame_number / elapsed.count () << " fps)");
+
+        // the reports go straight to stdout, so let the log catch up first to keep the output in order
+        vk_utils::logger::instance ().flush ();
+        profiler.report (std::cout);
+        allocator->report (std::cout);
+        graph->report (std::cout);
+        if ( validation )
+            validation->report (std::cout);
+        if ( culler )
+            culler->report (std::cout);
+    }
+
+    // How long each step of the constructor took, in the order they ran
+    const vk_utils::stage_timer &startup_timings () const { return startup; }
+
+    // Per message ID counters of the validation layer, null unless validation was requested
+    const vk_utils::validation_filter *validation_messages () const { return validation.get (); }
+
+    // Visible/culled counts of the GPU culled draws, null unless gpu culling is on
+    const vk_utils::cull_stats *cull_stats () const { return culler ? &culler->stats () : nullptr; }
+
+    /*
+     * Compiles a pipeline on the worker pool, the frame loop keeps drawing with the last pipeline that became ready,
+     * or the one built at startup, until this one is ready. A request still compiling is dropped by the next one. With
+     * gpu culling on the vertex shader reads vk_utils::instance_data from the instance stream instead of push
+     * constants, see shaders/shader_instanced.vert. The code is copied, so it may be freed as soon as this returns.
+     */
+    vkinit::pipeline_handle request_pipeline (vk_utils::spirv_code vertex_code, vk_utils::spirv_code fragment_code)
+    {
+        vkinit::graphics_pipeline_bundle_create_info pipeline_info {
+            device, vertex_code, fragment_code, swapchain.m_format, &pipeline_cache.m_impl, &shader_cache,
+            vertex_input (), draw_mode ()};
+
+        // the worker threads are only started once somebody asks for a pipeline
+        if ( !pipeline_builder )
+            pipeline_builder = std::make_unique<vkinit::async_pipeline_builder> ();
+        pending_pipeline = pipeline_builder->request (pipeline_info);
+        return pending_pipeline;
     }
 
+    /*
+     * Transfer and compute queues on their own families when the device has them, so streaming and compute
+     * work can overlap with rendering. Resources shared with the graphics queue need either
+     * vk::SharingMode::eConcurrent or a queue family ownership transfer.
+     */
+    const vkinit::device_queues &device_queues () const { return queues; }
+
+    // Every submission to a queue advances its timeline, wait on or poll the returned values
+    vk_utils::device_timelines &device_timelines () { return *timelines; }
+
   private:
     uint32_t width              = 800;
     uint32_t height             = 600;
+    bool headless               = false;
+    uint64_t frame_limit        = 0;
+    uint64_t frame_number       = 0;
     GLFWwindow *window          = nullptr;
     vk::raii::Instance instance = nullptr;
     std::unique_ptr<vk::raii::SurfaceKHR> surface {nullptr};
+    std::unique_ptr<vk_utils::validation_filter> validation;   // the messenger's user data, outlives it
     vk::raii::DebugUtilsMessengerEXT debug_messenger = nullptr;
     vk::raii::PhysicalDevice phys_device             = nullptr;
+    vkinit::device_capabilities capabilities;
     vk::raii::Device device                          = nullptr;
-    vk::raii::Queue graphics_queue                   = nullptr;
-    vk::raii::Queue present_queue                    = nullptr;
+    vk_utils::device_dispatch dispatch;   // only loaded when direct dispatch was requested
+    vkinit::device_queues queues;
+    std::unique_ptr<vk_utils::device_timelines> timelines;
+
+    // memory-related variables
+    std::unique_ptr<vk_utils::device_allocator> allocator;
+    vk::DeviceSize staging_buffer_size = 0;
+    std::unique_ptr<vk_utils::staging_ring> staging;
+
+    // geometry-related variables
+    bool split_vertex_streams = false;
+    vk_utils::mesh mesh;
+    uint32_t object_count = 1;
+    std::vector<vk_utils::draw_item> draw_list;
+
+    // gpu culling, the draw list becomes one instance_data per item
+    bool gpu_culling = false;
+    vk_utils::allocated_buffer instances;
+    std::unique_ptr<vk_utils::gpu_culler> culler;
+    vk_utils::frustum view_frustum = vk_utils::frustum::clip_space ();
+
+    // frame graph, rebuilt together with the swapchain
+    std::unique_ptr<vk_utils::render_graph> graph;
+    vk_utils::graph_image backbuffer;
+    vk_utils::graph_buffer cull_draws, cull_count, cull_readback;   // per frame in flight, set before every execute
+    uint32_t frame_image_index = 0;
+
+    vkinit::present_policy present_policy;
     vkinit::swapchain_bundle swapchain;
 
+    /*
+     * Swapchains replaced by a resize. The graphics timeline only covers the submissions, not the presents that
+     * wait on the per-image render_finished semaphores and read the images, and vkDestroySwapchainKHR and
+     * vkDestroySemaphore need those presents to have completed. Without a present fence there is no direct way to
+     * know that, so a retired swapchain lives on until max_frames_in_flight frames have been acquired from, submitted
+     * and presented to its successors and the last of those submissions has completed. Presents run in queue order
+     * and the CPU can't run more than max_frames_in_flight frames ahead, so by then the old presents are done.
+     */
+    struct retired_swapchain
+    {
+        vkinit::swapchain_bundle bundle;
+        std::unique_ptr<vk_utils::render_graph> graph;
+        uint32_t frames_left;   // frames still to go on the newer swapchains
+        uint64_t last_submit;   // graphics timeline value of the latest of those frames
+    };
+    std::vector<retired_swapchain> retired_swapchains;
+    bool framebuffer_resized = false;
+    bool minimized           = false;
+
     // pipeline-related variables
+    vkinit::pipeline_cache pipeline_cache;
+    vk_utils::shader_module_cache shader_cache;
     vkinit::graphics_pipeline_bundle pipeline_bundle {};
+    vkinit::pipeline_handle active_pipeline;    // last requested pipeline that became ready, drawn with
+    vkinit::pipeline_handle pending_pipeline;   // still compiling, replaces active_pipeline once ready
+    struct retired_pipeline
+    {
+        vkinit::pipeline_handle handle;
+        uint64_t last_submit;
+    };
+    std::vector<retired_pipeline> retired_pipelines;
+    std::unique_ptr<vkinit::async_pipeline_builder> pipeline_builder;   // null until the first request_pipeline ()
+
+    // recording-related variables
+    uint32_t recording_threads = 0;
+    std::unique_ptr<vk_utils::parallel_recorder> recorder;
+
+    // synchronization-related variables
+    uint32_t max_frames_in_flight = 2;
+    uint32_t current_frame        = 0;
+    std::vector<vk_utils::frame_in_flight> frames;
+
+    // profiling-related variables
+    vk_utils::gpu_profiler profiler;
+    vk_utils::stage_timer startup;
+
+    bool should_close ()
+    {
+        if ( frame_limit && frame_number >= frame_limit )
+            return true;
+        return !headless && glfwWindowShouldClose (window);
+    }
 
     // glfw setup
     void build_glfw_window ()
@@ -71,18 +355,585 @@ struct engine
         glfwInit ();
 
         glfwWindowHint (GLFW_CLIENT_API, GLFW_NO_API);   // no default rendering client
-        // resizing breaks the swapchain, we'll disable it for now
-        glfwWindowHint (GLFW_RESIZABLE, GLFW_FALSE);
+        glfwWindowHint (GLFW_RESIZABLE, GLFW_TRUE);
         if ( window = glfwCreateWindow (width, height, "First window", nullptr, nullptr) )
         {
 
-            std::cout << "Successfully made a GLFW window" << std::endl;
+            GRAPHICS_LOG_INFO ("Successfully made a GLFW window");
+
+            glfwSetWindowUserPointer (window, this);
+            glfwSetFramebufferSizeCallback (window, framebuffer_resize_callback);
         }
         else
         {
 
-            std::cout << "GLFW window creation failed" << std::endl;
+            GRAPHICS_LOG_ERROR ("GLFW window creation failed");
+        }
+    }
+
+    static void framebuffer_resize_callback (GLFWwindow *window, int, int)
+    {
+        static_cast<engine *> (glfwGetWindowUserPointer (window))->framebuffer_resized = true;
+    }
+
+    /*
+     * Only the swapchain, its image views and framebuffers are rebuilt, pipelines use dynamic viewport and
+     * scissor. The device is never drained: the old swapchain is handed to the driver as oldSwapchain and
+     * kept alive until its presents must have finished, see retired_swapchain.
+     */
+    void recreate_swapchain ()
+    {
+        if ( !headless )
+        {
+            int framebuffer_width = 0, framebuffer_height = 0;
+            glfwGetFramebufferSize (window, &framebuffer_width, &framebuffer_height);
+
+            // a minimized window has nothing to present to, so skip the work until it comes back
+            minimized = !framebuffer_width || !framebuffer_height;
+            if ( minimized )
+                return;
+
+            width  = static_cast<uint32_t> (framebuffer_width);
+            height = static_cast<uint32_t> (framebuffer_height);
+        }
+
+        vkinit::swapchain_bundle new_swapchain = vkinit::create_swapchain (
+            device, phys_device, *surface, capabilities, queues.families, width, height, present_policy,
+            *swapchain.m_impl);
+        vkinit::make_framebuffers (device, pipeline_bundle.m_renderpass, new_swapchain.m_extent,
+                                   new_swapchain.m_frames);
+
+        retired_swapchains.push_back (retired_swapchain {std::move (swapchain), std::move (graph), max_frames_in_flight,
+                                                         timelines->graphics ().last_submitted ()});
+        swapchain = std::move (new_swapchain);
+        build_render_graph ();
+
+        GRAPHICS_LOG_INFO ("Swapchain recreated with extent " << swapchain.m_extent.width << "x"
+                                                              << swapchain.m_extent.height);
+    }
+
+    void release_retired_resources ()
+    {
+        uint64_t completed = timelines->graphics ().completed ();
+
+        retired_swapchains.erase (std::remove_if (retired_swapchains.begin (), retired_swapchains.end (),
+                                                  [completed] (const retired_swapchain &retired) {
+                                                      return !retired.frames_left && retired.last_submit <= completed;
+                                                  }),
+                                  retired_swapchains.end ());
+
+        retired_pipelines.erase (std::remove_if (retired_pipelines.begin (), retired_pipelines.end (),
+                                                 [completed] (const retired_pipeline &retired) {
+                                                     return retired.last_submit <= completed;
+                                                 }),
+                                 retired_pipelines.end ());
+    }
+
+    // Called once per frame: swaps in a pending pipeline that has become ready and reports one that failed
+    void poll_pending_pipeline ()
+    {
+        if ( !pending_pipeline.valid () )
+            return;
+
+        if ( pending_pipeline.ready () )
+        {
+            // frames still in flight may be using the pipeline being replaced
+            if ( active_pipeline.valid () )
+                retired_pipelines.push_back (
+                    retired_pipeline {std::move (active_pipeline), timelines->graphics ().last_submitted ()});
+            active_pipeline  = std::move (pending_pipeline);
+            pending_pipeline = {};
+        }
+        else if ( pending_pipeline.failed () )
+        {
+            try
+            {
+                pending_pipeline.rethrow ();
+            } catch ( const std::exception &error )
+            {
+                GRAPHICS_LOG_ERROR ("Pipeline compilation failed, keeping the current pipeline: " << error.what ());
+            } catch ( ... )
+            {
+                GRAPHICS_LOG_ERROR ("Pipeline compilation failed with an unknown error, keeping the current pipeline");
+            }
+            pending_pipeline = {};
+        }
+    }
+
+    void make_frames ()
+    {
+        uint32_t graphics_family = queues.families.graphics_family.value ();
+
+        frames.reserve (max_frames_in_flight);
+        for ( uint32_t i = 0; i < max_frames_in_flight; ++i )
+        {
+            vk_utils::frame_in_flight frame;
+            frame.command_pool    = vkinit::make_command_pool (device, graphics_family);
+            frame.command_buffer  = vkinit::make_command_buffer (device, frame.command_pool);
+            frame.image_available = vkinit::make_semaphore (device);
+
+            frame.upload_command_buffer = vkinit::make_command_buffer (device, frame.command_pool);
+            frames.push_back (std::move (frame));
+        }
+
+        GRAPHICS_LOG_INFO ("Made " << max_frames_in_flight << " frame(s) in flight");
+
+        vk::DeviceSize copy_alignment = capabilities.properties.limits.optimalBufferCopyOffsetAlignment;
+        staging = std::make_unique<vk_utils::staging_ring> (*allocator, max_frames_in_flight, staging_buffer_size,
+                                                            copy_alignment);
+
+        float timestamp_period        = capabilities.properties.limits.timestampPeriod;
+        uint32_t timestamp_valid_bits = capabilities.queue_families[graphics_family].timestampValidBits;
+        profiler = vk_utils::gpu_profiler {device, max_frames_in_flight, timestamp_period, timestamp_valid_bits};
+
+        if ( recording_threads )
+        {
+            recorder = std::make_unique<vk_utils::parallel_recorder> (device, graphics_family, max_frames_in_flight,
+                                                                      recording_threads);
+            GRAPHICS_LOG_INFO ("Recording draws on " << recorder->thread_count () << " thread(s)");
+        }
+    }
+
+    vk::PipelineVertexInputStateCreateInfo vertex_input () const
+    {
+        if ( gpu_culling )
+            return split_vertex_streams ? vk_utils::instanced_split_vertex_input::state_info ()
+                                        : vk_utils::instanced_interleaved_vertex_input::state_info ();
+        if ( split_vertex_streams )
+            return vk_utils::split_vertex_input::state_info ();
+        return vk_utils::interleaved_vertex_input::state_info ();
+    }
+
+    vkinit::draw_mode draw_mode () const
+    {
+        return gpu_culling ? vkinit::draw_mode::gpu_culled : vkinit::draw_mode::direct;
+    }
+
+    // The contents are queued on the staging ring and reach the GPU with the first frame
+    void make_meshes ()
+    {
+        std::vector<uint32_t> indices = {0, 1, 2, 2, 3, 0};
+
+        if ( split_vertex_streams )
+        {
+            std::vector<vk_utils::vertex_position> positions = {
+                {{-0.5f, -0.5f}}, {{0.5f, -0.5f}}, {{0.5f, 0.5f}}, {{-0.5f, 0.5f}}};
+            std::vector<vk_utils::vertex_color> colors = {
+                {{1.0f, 0.0f, 0.0f}}, {{0.0f, 1.0f, 0.0f}}, {{0.0f, 0.0f, 1.0f}}, {{1.0f, 1.0f, 1.0f}}};
+            mesh = vk_utils::make_mesh (*allocator, *staging, indices, positions, colors);
+        }
+        else
+        {
+            std::vector<vk_utils::vertex> vertices = {{{-0.5f, -0.5f}, {1.0f, 0.0f, 0.0f}},
+                                                      {{0.5f, -0.5f}, {0.0f, 1.0f, 0.0f}},
+                                                      {{0.5f, 0.5f}, {0.0f, 0.0f, 1.0f}},
+                                                      {{-0.5f, 0.5f}, {1.0f, 1.0f, 1.0f}}};
+            mesh = vk_utils::make_mesh (*allocator, *staging, indices, vertices);
         }
+
+        // lay the objects out on a square grid covering the viewport
+        uint32_t side = static_cast<uint32_t> (std::ceil (std::sqrt (static_cast<double> (object_count))));
+        float cell    = 2.0f / side;
+
+        draw_list.reserve (object_count);
+        for ( uint32_t i = 0; i < object_count; ++i )
+        {
+            vk_utils::draw_item item;
+            item.geometry            = &mesh;
+            item.constants.offset[0] = -1.0f + cell * (i % side + 0.5f);
+            item.constants.offset[1] = -1.0f + cell * (i / side + 0.5f);
+            item.constants.scale     = object_count == 1 ? 1.0f : cell * 0.8f;
+            draw_list.push_back (item);
+        }
+
+        // every corner of the quad is this far from its origin
+        if ( gpu_culling )
+            make_instances (std::hypot (0.5f, 0.5f));
+    }
+
+    // The draw list as one device local instance_data array, read by both the culling and the vertex shader
+    void make_instances (float mesh_radius)
+    {
+        std::vector<vk_utils::instance_data> data;
+        data.reserve (draw_list.size ());
+        for ( auto &item : draw_list )
+        {
+            vk_utils::instance_data instance;
+            instance.offset = item.constants.offset;
+            instance.scale  = item.constants.scale;
+            instance.radius = mesh_radius * item.constants.scale;
+            data.push_back (instance);
+        }
+
+        vk::BufferCreateInfo instance_info {};
+        instance_info.size  = sizeof (vk_utils::instance_data) * data.size ();
+        instance_info.usage = vk::BufferUsageFlagBits::eVertexBuffer | vk::BufferUsageFlagBits::eStorageBuffer |
+                              vk::BufferUsageFlagBits::eTransferDst;
+        instance_info.sharingMode = vk::SharingMode::eExclusive;
+        instances = allocator->create_buffer (instance_info, vk::MemoryPropertyFlagBits::eDeviceLocal);
+        staging->upload_buffer (data.data (), instance_info.size, **instances);
+
+        culler = std::make_unique<vk_utils::gpu_culler> (
+            device, *allocator, vk_utils::as_spirv (shaders::cull_spv), **instances,
+            static_cast<uint32_t> (data.size ()), max_frames_in_flight, &pipeline_cache.m_impl, &shader_cache);
+    }
+
+    /*
+     * The swapchain image comes out of vkAcquireNextImageKHR in an undefined layout, guarded by a semaphore the
+     * submission waits on at the color attachment stage, and has to end up ready for presenting
+     */
+    void build_render_graph ()
+    {
+        using usage = vk_utils::resource_usage;
+
+        graph      = std::make_unique<vk_utils::render_graph> ();
+        backbuffer = graph->import_image ("backbuffer", vk::ImageAspectFlagBits::eColor, vk::ImageLayout::eUndefined,
+                                          vk::PipelineStageFlagBits2::eColorAttachmentOutput,
+                                          vk::ImageLayout::ePresentSrcKHR);
+        vk_utils::graph_buffer vertices = graph->import_buffer ("vertices", **mesh.m_vertices);
+        vk_utils::graph_buffer indices  = graph->import_buffer ("indices", **mesh.m_indices);
+
+        vk_utils::graph_buffer instance_buffer;
+        if ( culler )
+        {
+            instance_buffer = graph->import_buffer ("instances", **instances);
+            add_culling_passes (instance_buffer);
+        }
+
+        vk_utils::pass_builder main_pass =
+            graph
+                ->add_pass ("main renderpass",
+                            [this] (vk::raii::CommandBuffer &command_buffer, const vk_utils::render_graph &) {
+                                record_draw_commands (command_buffer, frame_image_index);
+                            })
+                .write (backbuffer, usage::color_attachment_write)
+                .read (vertices, usage::vertex_buffer_read)
+                .read (indices, usage::index_buffer_read);
+        if ( culler )
+            main_pass.read (cull_draws, usage::indirect_read)
+                .read (cull_count, usage::indirect_read)
+                .read (instance_buffer, usage::vertex_buffer_read);
+
+        graph->compile (device, *allocator);
+    }
+
+    // The draw count starts at zero every frame, the culling shader fills the draws and the count is copied out
+    void add_culling_passes (vk_utils::graph_buffer instance_buffer)
+    {
+        using usage = vk_utils::resource_usage;
+
+        cull_draws    = graph->import_buffer ("cull draws");
+        cull_count    = graph->import_buffer ("cull count");
+        cull_readback = graph->import_buffer ("cull readback");
+
+        graph
+            ->add_pass ("reset draw count",
+                        [this] (vk::raii::CommandBuffer &command_buffer, const vk_utils::render_graph &) {
+                            culler->record_reset (command_buffer, current_frame);
+                        })
+            .write (cull_count, usage::transfer_write);
+
+        graph
+            ->add_pass ("cull",
+                        [this] (vk::raii::CommandBuffer &command_buffer, const vk_utils::render_graph &) {
+                            vk_utils::gpu_profiler::scope cull_scope {profiler, command_buffer, "cull"};
+                            culler->record_cull (command_buffer, current_frame, view_frustum, mesh.m_index_count);
+                        })
+            .read (instance_buffer, usage::storage_read)
+            .write (cull_draws, usage::storage_write)
+            .write (cull_count, usage::storage_write);
+
+        graph
+            ->add_pass ("read back draw count",
+                        [this] (vk::raii::CommandBuffer &command_buffer, const vk_utils::render_graph &) {
+                            culler->record_readback (command_buffer, current_frame);
+                        })
+            .read (cull_count, usage::transfer_read)
+            .write (cull_readback, usage::transfer_write)
+            .side_effects ();
+    }
+
+    void record_draw_commands (vk::raii::CommandBuffer &command_buffer, uint32_t image_index)
+    {
+        vk::ClearValue clear_color = vk::ClearColorValue {std::array<float, 4> {0.0f, 0.0f, 0.0f, 1.0f}};
+
+        vk::RenderPassBeginInfo renderpass_info = {};
+        renderpass_info.renderPass              = *pipeline_bundle.m_renderpass;
+        renderpass_info.framebuffer             = *swapchain.m_frames[image_index].framebuffer;
+        renderpass_info.renderArea.offset.x     = 0;
+        renderpass_info.renderArea.offset.y     = 0;
+        renderpass_info.renderArea.extent       = swapchain.m_extent;
+        renderpass_info.clearValueCount         = 1;
+        renderpass_info.pClearValues            = &clear_color;
+
+        // picked once so that every slice of the frame draws with the same pipeline
+        const vkinit::graphics_pipeline_bundle &bundle = active_pipeline.get_or (pipeline_bundle);
+        uint32_t draw_count                            = static_cast<uint32_t> (draw_list.size ());
+
+        {
+            vk_utils::gpu_profiler::scope renderpass_scope {profiler, command_buffer, "main renderpass"};
+            if ( bundle.m_mode == vkinit::draw_mode::gpu_culled )
+            {
+                // a single draw, nothing worth spreading over the recording threads
+                command_buffer.beginRenderPass (renderpass_info, vk::SubpassContents::eInline);
+                if ( dispatch.loaded () )
+                    record_culled_draws_direct (*command_buffer, bundle);
+                else
+                {
+                    command_buffer.bindPipeline (vk::PipelineBindPoint::eGraphics, *bundle.m_pipeline);
+                    set_viewport_and_scissor (command_buffer);
+                    culler->record_draws (command_buffer, current_frame, mesh);
+                }
+            }
+            else if ( recorder )
+            {
+                command_buffer.beginRenderPass (renderpass_info, vk::SubpassContents::eSecondaryCommandBuffers);
+
+                vk::CommandBufferInheritanceInfo inheritance {};
+                inheritance.renderPass  = *pipeline_bundle.m_renderpass;
+                inheritance.subpass     = 0;
+                inheritance.framebuffer = *swapchain.m_frames[image_index].framebuffer;
+
+                recorder->record (command_buffer, current_frame, draw_count, inheritance,
+                                  [this, &bundle] (vk::raii::CommandBuffer &secondary, uint32_t begin, uint32_t end) {
+                                      record_draw_items (secondary, bundle, begin, end);
+                                  });
+            }
+            else
+            {
+                command_buffer.beginRenderPass (renderpass_info, vk::SubpassContents::eInline);
+                record_draw_items (command_buffer, bundle, 0, draw_count);
+            }
+            command_buffer.endRenderPass ();
+        }
+    }
+
+    // Records draw_list[begin, end) into a command buffer that has no state bound yet
+    void record_draw_items (vk::raii::CommandBuffer &command_buffer, const vkinit::graphics_pipeline_bundle &bundle,
+                            uint32_t begin, uint32_t end)
+    {
+        if ( dispatch.loaded () )
+        {
+            record_draw_items_direct (*command_buffer, bundle, begin, end);
+            return;
+        }
+
+        command_buffer.bindPipeline (vk::PipelineBindPoint::eGraphics, *bundle.m_pipeline);
+        set_viewport_and_scissor (command_buffer);
+
+        const vk_utils::mesh *bound = nullptr;
+        for ( uint32_t i = begin; i < end; ++i )
+        {
+            const vk_utils::draw_item &item = draw_list[i];
+            if ( item.geometry != bound )
+            {
+                item.geometry->bind (command_buffer);
+                bound = item.geometry;
+            }
+            command_buffer.pushConstants<vk_utils::draw_constants> (*bundle.m_layout, vk::ShaderStageFlagBits::eVertex,
+                                                                    0, item.constants);
+            item.geometry->draw (command_buffer);
+        }
+    }
+
+    // The same commands as record_draw_items () through the device_dispatch table
+    void record_draw_items_direct (vk::CommandBuffer command_buffer, const vkinit::graphics_pipeline_bundle &bundle,
+                                   uint32_t begin, uint32_t end)
+    {
+        VkCommandBuffer handle  = static_cast<VkCommandBuffer> (command_buffer);
+        VkPipelineLayout layout = static_cast<VkPipelineLayout> (*bundle.m_layout);
+
+        dispatch.vkCmdBindPipeline (handle, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                                    static_cast<VkPipeline> (*bundle.m_pipeline));
+        vk::Viewport viewport = full_viewport ();
+        vk::Rect2D scissor    = full_scissor ();
+        dispatch.vkCmdSetViewport (handle, 0, 1, reinterpret_cast<const VkViewport *> (&viewport));
+        dispatch.vkCmdSetScissor (handle, 0, 1, reinterpret_cast<const VkRect2D *> (&scissor));
+
+        const vk_utils::mesh *bound = nullptr;
+        for ( uint32_t i = begin; i < end; ++i )
+        {
+            const vk_utils::draw_item &item = draw_list[i];
+            if ( item.geometry != bound )
+            {
+                item.geometry->bind (dispatch, command_buffer);
+                bound = item.geometry;
+            }
+            dispatch.vkCmdPushConstants (handle, layout, VK_SHADER_STAGE_VERTEX_BIT, 0,
+                                         sizeof (vk_utils::draw_constants), &item.constants);
+            item.geometry->draw (dispatch, command_buffer);
+        }
+    }
+
+    // The GPU culled draw through the device_dispatch table
+    void record_culled_draws_direct (vk::CommandBuffer command_buffer, const vkinit::graphics_pipeline_bundle &bundle)
+    {
+        VkCommandBuffer handle = static_cast<VkCommandBuffer> (command_buffer);
+
+        dispatch.vkCmdBindPipeline (handle, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                                    static_cast<VkPipeline> (*bundle.m_pipeline));
+        vk::Viewport viewport = full_viewport ();
+        vk::Rect2D scissor    = full_scissor ();
+        dispatch.vkCmdSetViewport (handle, 0, 1, reinterpret_cast<const VkViewport *> (&viewport));
+        dispatch.vkCmdSetScissor (handle, 0, 1, reinterpret_cast<const VkRect2D *> (&scissor));
+        culler->record_draws (dispatch, command_buffer, current_frame, mesh);
+    }
+
+    vk::Viewport full_viewport () const
+    {
+        vk::Viewport viewport = {};
+        viewport.x            = 0.0f;
+        viewport.y            = 0.0f;
+        viewport.width        = static_cast<float> (swapchain.m_extent.width);
+        viewport.height       = static_cast<float> (swapchain.m_extent.height);
+        viewport.minDepth     = 0.0f;
+        viewport.maxDepth     = 1.0f;
+        return viewport;
+    }
+
+    vk::Rect2D full_scissor () const
+    {
+        vk::Rect2D scissor = {};
+        scissor.offset.x   = 0;
+        scissor.offset.y   = 0;
+        scissor.extent     = swapchain.m_extent;
+        return scissor;
+    }
+
+    void set_viewport_and_scissor (vk::raii::CommandBuffer &command_buffer)
+    {
+        command_buffer.setViewport (0, full_viewport ());
+        command_buffer.setScissor (0, full_scissor ());
+    }
+
+    // Returns whether anything was recorded, an empty upload command buffer isn't worth submitting
+    bool record_uploads (vk::raii::CommandBuffer &command_buffer)
+    {
+        staging->end_frame ();
+        if ( !staging->pending () )
+            return false;
+
+        vk::CommandBufferBeginInfo begin_info {};
+        begin_info.flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit;
+        command_buffer.begin (begin_info);
+        staging->record (command_buffer);
+        command_buffer.end ();
+        return true;
+    }
+
+    void record_frame (vk::raii::CommandBuffer &command_buffer, uint32_t image_index)
+    {
+        vk::CommandBufferBeginInfo begin_info {};
+        begin_info.flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit;
+        command_buffer.begin (begin_info);
+
+        profiler.begin_frame (command_buffer, current_frame);
+        {
+            vk_utils::gpu_profiler::scope frame_scope {profiler, command_buffer, "frame"};
+
+            vk_utils::swapchain_frame &target = swapchain.m_frames[image_index];
+            frame_image_index                 = image_index;
+            graph->set_image (backbuffer, target.image, *target.image_view);
+            if ( culler )
+            {
+                graph->set_buffer (cull_draws, culler->draws (current_frame));
+                graph->set_buffer (cull_count, culler->count (current_frame));
+                graph->set_buffer (cull_readback, culler->readback (current_frame));
+            }
+            graph->execute (command_buffer);
+        }
+
+        command_buffer.end ();
+    }
+
+    // Returns false when no frame could be rendered, e.g. while the swapchain is being rebuilt
+    bool draw_frame ()
+    {
+        if ( framebuffer_resized )
+        {
+            framebuffer_resized = false;
+            recreate_swapchain ();
+        }
+
+        if ( minimized )
+        {
+            glfwWaitEvents ();
+            return false;
+        }
+
+        vk_utils::frame_in_flight &frame = frames[current_frame];
+
+        // wait until the GPU is done with the commands recorded the last time this frame slot was used
+        vk_utils::queue_timeline &graphics_timeline = timelines->graphics ();
+        graphics_timeline.wait (frame.timeline_value);
+        if ( culler )
+            culler->collect (current_frame);
+        release_retired_resources ();
+        poll_pending_pipeline ();
+        staging->begin_frame (current_frame);
+
+        uint32_t image_index = 0;
+        try
+        {
+            vk::Result acquire_result;
+            std::tie (acquire_result, image_index) =
+                swapchain.m_impl.acquireNextImage (UINT64_MAX, *frame.image_available);
+
+            // a suboptimal image can still be presented, rebuild right after this frame
+            if ( acquire_result == vk::Result::eSuboptimalKHR )
+                framebuffer_resized = true;
+        } catch ( vk::OutOfDateKHRError & )
+        {
+            recreate_swapchain ();
+            return false;
+        }
+
+        // a pool per frame lets us recycle every buffer allocated from it at once
+        frame.command_pool.reset ();
+        bool has_uploads = record_uploads (frame.upload_command_buffer);
+        record_frame (frame.command_buffer, image_index);
+
+        // the uploads go first in the same submission, their barrier covers the draws that follow
+        vk_utils::submit_batch batch;
+        if ( has_uploads )
+            batch.command_buffers.push_back (*frame.upload_command_buffer);
+        batch.command_buffers.push_back (*frame.command_buffer);
+        batch.wait (*frame.image_available, vk::PipelineStageFlagBits::eColorAttachmentOutput);
+        // per swapchain image, a frame's timeline value says nothing about when its present has consumed the wait
+        vk::Semaphore render_finished = *swapchain.m_frames[image_index].render_finished;
+        batch.signal (render_finished);
+
+        frame.timeline_value = graphics_timeline.submit (batch);
+
+        // presenting this frame ends one more of the frames the retired swapchains are waiting for
+        for ( retired_swapchain &retired : retired_swapchains )
+            if ( retired.frames_left )
+            {
+                --retired.frames_left;
+                retired.last_submit = frame.timeline_value;
+            }
+
+        vk::Semaphore signal_semaphores[] = {render_finished};
+        vk::SwapchainKHR swapchains[]     = {*swapchain.m_impl};
+
+        vk::PresentInfoKHR present_info = {};
+        present_info.waitSemaphoreCount = 1;
+        present_info.pWaitSemaphores    = signal_semaphores;
+        present_info.swapchainCount     = 1;
+        present_info.pSwapchains        = swapchains;
+        present_info.pImageIndices      = &image_index;
+
+        try
+        {
+            if ( queues.present.presentKHR (present_info) == vk::Result::eSuboptimalKHR )
+                framebuffer_resized = true;
+        } catch ( vk::OutOfDateKHRError & )
+        {
+            framebuffer_resized = true;
+        }
+
+        current_frame = (current_frame + 1) % max_frames_in_flight;
+        return true;
     }
 };
-}   // namespace graphics
\ No newline at end of file
+}   // namespace graphics
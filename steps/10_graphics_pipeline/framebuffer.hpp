@@ -0,0 +1,34 @@
+#pragma once
+
+#include "frames.hpp"
+
+#include <vector>
+#include <vulkan/vulkan_raii.hpp>
+
+namespace graphics
+{
+namespace vkinit
+{
+
+inline void make_framebuffers (vk::raii::Device &device, vk::raii::RenderPass &renderpass, vk::Extent2D extent,
+                               std::vector<vk_utils::swapchain_frame> &frames)
+{
+    for ( auto &frame : frames )
+    {
+        vk::ImageView attachments[] = {*frame.image_view};
+
+        vk::FramebufferCreateInfo framebuffer_info {};
+        framebuffer_info.flags           = vk::FramebufferCreateFlags ();
+        framebuffer_info.renderPass      = *renderpass;
+        framebuffer_info.attachmentCount = 1;
+        framebuffer_info.pAttachments    = attachments;
+        framebuffer_info.width           = extent.width;
+        framebuffer_info.height          = extent.height;
+        framebuffer_info.layers          = 1;
+
+        frame.framebuffer = device.createFramebuffer (framebuffer_info);
+    }
+}
+
+}   // namespace vkinit
+}   // namespace graphics
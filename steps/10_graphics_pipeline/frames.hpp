@@ -11,6 +11,20 @@ struct swapchain_frame
 {
     vk::Image image {nullptr};
     vk::raii::ImageView image_view {nullptr};
+    vk::raii::Framebuffer framebuffer {nullptr};
+    // the present of this image waits on it, so it can only be signalled again once the image is reacquired
+    vk::raii::Semaphore render_finished {nullptr};
 };
+
+// Everything the CPU needs to record and submit one frame while the GPU may still be busy with the others
+struct frame_in_flight
+{
+    vk::raii::CommandPool command_pool {nullptr};
+    vk::raii::CommandBuffer command_buffer {nullptr};
+    vk::raii::CommandBuffer upload_command_buffer {nullptr};   // staging copies, submitted before command_buffer
+    vk::raii::Semaphore image_available {nullptr};
+    uint64_t timeline_value = 0;   // graphics timeline value reached once this frame's last submission is done
+};
+
 }   // namespace vk_utils
-}   // namespace graphics
\ No newline at end of file
+}   // namespace graphics
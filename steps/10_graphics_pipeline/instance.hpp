@@ -1,10 +1,12 @@
 #pragma once
 
+#include "logger.hpp"
+
 #include <vulkan/vulkan_raii.hpp>
 
 #include <GLFW/glfw3.h>
 
-#include <iostream>
+#include <cstring>
 
 namespace graphics
 {
@@ -17,9 +19,9 @@ bool is_supported (std::vector<const char *> &extensions, std::vector<const char
     // check extension support
     std::vector<vk::ExtensionProperties> supported_extensions = context.enumerateInstanceExtensionProperties ();
 
-    std::cout << "Device can support the folowwing extensions:" << std::endl;
+    GRAPHICS_LOG_TRACE ("Device can support the folowwing extensions:");
     for ( auto &s_extension : supported_extensions )
-        std::cout << "\t\"" << s_extension.extensionName << "\"" << std::endl;
+        GRAPHICS_LOG_TRACE ("\t\"" << s_extension.extensionName.data () << "\"");
 
     bool found;
     for ( const char *extension : extensions )
@@ -31,13 +33,13 @@ bool is_supported (std::vector<const char *> &extensions, std::vector<const char
             {
                 found = true;
 
-                std::cout << "Extension \"" << extension << "\" is supported!\n";
+                GRAPHICS_LOG_DEBUG ("Extension \"" << extension << "\" is supported!");
             }
         }
         if ( !found )
         {
 
-            std::cout << "Extension \"" << extension << "\" is not supported!\n";
+            GRAPHICS_LOG_ERROR ("Extension \"" << extension << "\" is not supported!");
 
             return false;
         }
@@ -46,10 +48,10 @@ bool is_supported (std::vector<const char *> &extensions, std::vector<const char
     // check layer support
     std::vector<vk::LayerProperties> supported_layers = vk::enumerateInstanceLayerProperties ();
 
-    std::cout << "Device can support the following layers:\n";
+    GRAPHICS_LOG_TRACE ("Device can support the following layers:");
     for ( vk::LayerProperties s_layer : supported_layers )
     {
-        std::cout << '\t' << s_layer.layerName << '\n';
+        GRAPHICS_LOG_TRACE ('\t' << s_layer.layerName.data ());
     }
 
     for ( const char *layer : layers )
@@ -61,13 +63,13 @@ bool is_supported (std::vector<const char *> &extensions, std::vector<const char
             {
                 found = true;
 
-                std::cout << "Layer \"" << layer << "\" is supported!\n";
+                GRAPHICS_LOG_DEBUG ("Layer \"" << layer << "\" is supported!");
             }
         }
         if ( !found )
         {
 
-            std::cout << "Layer \"" << layer << "\" is not supported!\n";
+            GRAPHICS_LOG_ERROR ("Layer \"" << layer << "\" is not supported!");
 
             return false;
         }
@@ -76,20 +78,14 @@ bool is_supported (std::vector<const char *> &extensions, std::vector<const char
     return true;
 }
 
-vk::raii::Instance make_instance (const std::string &appName)
+/*
+ * Headless instances don't talk to a window system at all, so GLFW is never asked for its extensions.
+ * VK_EXT_headless_surface gives us a surface that still goes through the regular swapchain path.
+ */
+std::vector<const char *> get_surface_extensions (bool headless)
 {
-
-    std::cout << "Making an vulkan instance..." << std::endl;
-
-    vk::raii::Context context;
-
-    uint32_t version = context.enumerateInstanceVersion ();
-
-    std::cout << "System can support vulkan Variant: " << VK_API_VERSION_VARIANT (version)
-              << ", Major: " << VK_API_VERSION_MAJOR (version) << ", Minor: " << VK_API_VERSION_MINOR (version)
-              << ", Patch: " << VK_API_VERSION_PATCH (version) << std::endl;
-
-    vk::ApplicationInfo appInfo {appName.c_str (), version, "First engine", version, version};
+    if ( headless )
+        return {VK_KHR_SURFACE_EXTENSION_NAME, VK_EXT_HEADLESS_SURFACE_EXTENSION_NAME};
 
     /*
      * Everything with Vulkan is "opt-in", so we need to query which extensions glfw needs
@@ -99,17 +95,39 @@ vk::raii::Instance make_instance (const std::string &appName)
     const char **arr_glfw_extensions;
     arr_glfw_extensions = glfwGetRequiredInstanceExtensions (&glfw_ext_count);
 
-    std::vector<const char *> glfw_extensions (arr_glfw_extensions, arr_glfw_extensions + glfw_ext_count);
+    return std::vector<const char *> (arr_glfw_extensions, arr_glfw_extensions + glfw_ext_count);
+}
+
+// The validation layer and VK_EXT_debug_utils are opt-in, a regular run pays for neither
+vk::raii::Instance make_instance (const std::string &appName, bool headless = false, bool validation = false)
+{
+
+    GRAPHICS_LOG_INFO ("Making an vulkan instance...");
+
+    vk::raii::Context context;
+
+    uint32_t version = context.enumerateInstanceVersion ();
+
+    GRAPHICS_LOG_INFO ("System can support vulkan Variant: "
+                       << VK_API_VERSION_VARIANT (version) << ", Major: " << VK_API_VERSION_MAJOR (version)
+                       << ", Minor: " << VK_API_VERSION_MINOR (version)
+                       << ", Patch: " << VK_API_VERSION_PATCH (version));
+
+    vk::ApplicationInfo appInfo {appName.c_str (), version, "First engine", version, version};
+
+    std::vector<const char *> glfw_extensions = get_surface_extensions (headless);
 
-    glfw_extensions.push_back ("VK_EXT_debug_utils");
+    if ( validation )
+        glfw_extensions.push_back (VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
 
-    std::cout << "Extensions to be requated by GLFW:" << std::endl;
+    GRAPHICS_LOG_DEBUG ("Extensions to be requated:");
     for ( auto &extension : glfw_extensions )
-        std::cout << "\t\"" << extension << "\"" << std::endl;
+        GRAPHICS_LOG_DEBUG ("\t\"" << extension << "\"");
 
     std::vector<const char *> layers;
 
-    layers.push_back ("VK_LAYER_KHRONOS_validation");
+    if ( validation )
+        layers.push_back ("VK_LAYER_KHRONOS_validation");
 
     if ( !is_supported (glfw_extensions, layers, context) )
     {
@@ -0,0 +1,318 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <thread>
+
+/*
+ * Messages below GRAPHICS_LOG_LEVEL are compiled out: 0 - trace, 1 - debug, 2 - info, 3 - warning, 4 - error.
+ * Release builds keep info and above unless told otherwise.
+ */
+#ifndef GRAPHICS_LOG_LEVEL
+#ifdef NDEBUG
+#define GRAPHICS_LOG_LEVEL 2
+#else
+#define GRAPHICS_LOG_LEVEL 0
+#endif
+#endif
+
+namespace graphics
+{
+namespace vk_utils
+{
+
+enum class log_level : uint8_t
+{
+    trace,
+    debug,
+    info,
+    warning,
+    error,
+};
+
+constexpr log_level compiled_log_level = static_cast<log_level> (GRAPHICS_LOG_LEVEL);
+// Trace and debug stay compiled into debug builds, but only show up when asked for at runtime
+constexpr log_level default_log_level = std::max (compiled_log_level, log_level::info);
+
+inline const char *to_string (log_level level)
+{
+    switch ( level )
+    {
+    case log_level::trace:
+        return "trace";
+    case log_level::debug:
+        return "debug";
+    case log_level::info:
+        return "info";
+    case log_level::warning:
+        return "warning";
+    case log_level::error:
+        return "error";
+    }
+    return "unknown";
+}
+
+/*
+ * Formats messages into a fixed buffer without allocating. Whatever doesn't fit is cut off, overflow () fails
+ * and the stream stops accepting output until the next reset ().
+ */
+struct log_message_buffer : std::streambuf
+{
+    static constexpr std::size_t capacity = 1024;
+
+    void reset () { setp (m_text, m_text + capacity); }
+
+    const char *data () const { return m_text; }
+    std::size_t size () const { return static_cast<std::size_t> (pptr () - pbase ()); }
+
+  private:
+    char m_text[capacity];
+};
+
+struct log_message_stream
+{
+    log_message_stream () : m_stream {&m_buffer} {}
+
+    std::ostream &begin ()
+    {
+        m_buffer.reset ();
+        m_stream.clear ();
+        return m_stream;
+    }
+
+    const char *data () const { return m_buffer.data (); }
+    std::size_t size () const { return m_buffer.size (); }
+
+  private:
+    log_message_buffer m_buffer;
+    std::ostream m_stream;
+};
+
+/*
+ * Threads only copy formatted messages into a bounded lock-free ring (Vyukov's MPMC queue with one consumer), a
+ * background thread writes them out and flushes once per batch instead of once per line. When the ring is full
+ * trace/debug/info messages are dropped and counted, warnings and errors wait for a free slot. Errors don't return
+ * before they have been written.
+ */
+struct logger
+{
+    static logger &instance ()
+    {
+        static logger global;
+        return global;
+    }
+
+    logger (const logger &)             = delete;
+    logger &operator= (const logger &) = delete;
+
+    ~logger ()
+    {
+        m_stopping.store (true, std::memory_order_release);
+        m_wake.notify_one ();
+        m_writer.join ();
+    }
+
+    // Runtime filter on top of GRAPHICS_LOG_LEVEL, it can't bring back levels that were compiled out. Starts at
+    // default_log_level.
+    void set_level (log_level level) { m_level.store (level, std::memory_order_relaxed); }
+    log_level level () const { return m_level.load (std::memory_order_relaxed); }
+    bool enabled (log_level level) const { return level >= this->level (); }
+
+    void push (log_level level, const char *text, std::size_t length)
+    {
+        length = std::min (length, log_message_buffer::capacity);
+
+        uint64_t position = m_head.load (std::memory_order_relaxed);
+        slot *target      = nullptr;
+        for ( ;; )
+        {
+            target            = &m_slots[position & (slot_count - 1)];
+            uint64_t sequence = target->sequence.load (std::memory_order_acquire);
+            int64_t lag       = static_cast<int64_t> (sequence - position);
+
+            if ( lag == 0 )
+            {
+                if ( m_head.compare_exchange_weak (position, position + 1, std::memory_order_relaxed) )
+                    break;
+            }
+            else if ( lag < 0 )
+            {
+                // the writer hasn't caught up with this lap of the ring yet
+                if ( level < log_level::warning )
+                {
+                    m_dropped.fetch_add (1, std::memory_order_relaxed);
+                    return;
+                }
+                m_wake.notify_one ();
+                std::this_thread::yield ();
+                position = m_head.load (std::memory_order_relaxed);
+            }
+            else
+                position = m_head.load (std::memory_order_relaxed);
+        }
+
+        target->level  = level;
+        target->length = static_cast<uint32_t> (length);
+        std::memcpy (target->text, text, length);
+        target->sequence.store (position + 1, std::memory_order_release);
+
+        // an error is often followed by a throw nothing catches, write it out before std::terminate gets a chance
+        if ( level >= log_level::error )
+            flush ();
+        else if ( level >= log_level::warning )
+            m_wake.notify_one ();
+    }
+
+    // Blocks until everything pushed before the call has been written out and flushed
+    void flush ()
+    {
+        uint64_t target = m_head.load (std::memory_order_acquire);
+        while ( m_written.load (std::memory_order_acquire) < target )
+        {
+            m_wake.notify_one ();
+            std::this_thread::sleep_for (std::chrono::microseconds {100});
+        }
+    }
+
+    uint64_t dropped () const { return m_dropped.load (std::memory_order_relaxed); }
+
+    // Per-thread formatting scratch used by the GRAPHICS_LOG_* macros
+    static log_message_stream &message_stream ()
+    {
+        static thread_local log_message_stream stream;
+        return stream;
+    }
+
+  private:
+    static constexpr std::size_t slot_count = 512;   // must be a power of two
+
+    struct slot
+    {
+        std::atomic<uint64_t> sequence {0};
+        log_level level = log_level::info;
+        uint32_t length = 0;
+        char text[log_message_buffer::capacity];
+    };
+
+    std::unique_ptr<slot[]> m_slots;
+    alignas (64) std::atomic<uint64_t> m_head {0};
+    alignas (64) uint64_t m_tail = 0;   // only touched by the writer
+    std::atomic<uint64_t> m_written {0};
+    std::atomic<uint64_t> m_dropped {0};
+    uint64_t m_reported_dropped = 0;
+
+    std::atomic<log_level> m_level {default_log_level};
+    std::atomic<bool> m_stopping {false};
+    std::mutex m_wake_mutex;
+    std::condition_variable m_wake;
+    std::thread m_writer;
+
+    logger () : m_slots {new slot[slot_count]}
+    {
+        for ( std::size_t i = 0; i < slot_count; ++i )
+            m_slots[i].sequence.store (i, std::memory_order_relaxed);
+        m_writer = std::thread {[this] { write_loop (); }};
+    }
+
+    void write_loop ()
+    {
+        for ( ;; )
+        {
+            bool stopping = m_stopping.load (std::memory_order_acquire);
+            bool written  = drain ();
+
+            if ( stopping )
+                return;
+            if ( !written )
+            {
+                // notify_one () isn't ordered with the ring, so a wakeup can be missed, the timeout bounds the delay
+                std::unique_lock<std::mutex> lock {m_wake_mutex};
+                m_wake.wait_for (lock, std::chrono::milliseconds {20});
+            }
+        }
+    }
+
+    // Writes out every message that is ready, returns false if there was none
+    bool drain ()
+    {
+        bool written = false;
+        for ( ;; )
+        {
+            slot &source = m_slots[m_tail & (slot_count - 1)];
+            if ( source.sequence.load (std::memory_order_acquire) != m_tail + 1 )
+                break;
+
+            std::ostream &sink = source.level >= log_level::warning ? std::cerr : std::cout;
+            if ( source.level != log_level::info )
+                sink << '[' << to_string (source.level) << "] ";
+            sink.write (source.text, source.length);
+            sink.put ('\n');
+
+            source.sequence.store (m_tail + slot_count, std::memory_order_release);
+            ++m_tail;
+            written = true;
+        }
+
+        uint64_t dropped = m_dropped.load (std::memory_order_relaxed);
+        if ( dropped != m_reported_dropped )
+        {
+            std::cerr << "[warning] logger dropped " << dropped - m_reported_dropped << " message(s)\n";
+            m_reported_dropped = dropped;
+            written            = true;
+        }
+
+        if ( written )
+        {
+            std::cout.flush ();
+            std::cerr.flush ();
+            m_written.store (m_tail, std::memory_order_release);
+        }
+        return written;
+    }
+};
+
+}   // namespace vk_utils
+}   // namespace graphics
+
+/*
+ * GRAPHICS_LOG_INFO ("Swapchain has " << count << " image(s)"), the argument is a chain of stream insertions. Levels
+ * below GRAPHICS_LOG_LEVEL are discarded by if constexpr, so their arguments are never evaluated and no code is
+ * emitted for them.
+ */
+#define GRAPHICS_LOG(level, message)                                                                                   \
+    do                                                                                                                 \
+    {                                                                                                                  \
+        if constexpr ( ::graphics::vk_utils::log_level::level >= ::graphics::vk_utils::compiled_log_level )            \
+        {                                                                                                              \
+            ::graphics::vk_utils::logger &graphics_logger = ::graphics::vk_utils::logger::instance ();                 \
+            if ( graphics_logger.enabled (::graphics::vk_utils::log_level::level) )                                    \
+            {                                                                                                          \
+                ::graphics::vk_utils::log_message_stream &graphics_log_stream =                                        \
+                    ::graphics::vk_utils::logger::message_stream ();                                                   \
+                graphics_log_stream.begin () << message;                                                               \
+                graphics_logger.push (::graphics::vk_utils::log_level::level, graphics_log_stream.data (),             \
+                                      graphics_log_stream.size ());                                                    \
+            }                                                                                                          \
+        }                                                                                                              \
+    } while ( 0 )
+
+#define GRAPHICS_LOG_TRACE(message)   GRAPHICS_LOG (trace, message)
+#define GRAPHICS_LOG_DEBUG(message)   GRAPHICS_LOG (debug, message)
+#define GRAPHICS_LOG_INFO(message)    GRAPHICS_LOG (info, message)
+#define GRAPHICS_LOG_WARNING(message) GRAPHICS_LOG (warning, message)
+#define GRAPHICS_LOG_ERROR(message)   GRAPHICS_LOG (error, message)
+
+// For dumps that loop or query before logging: if ( GRAPHICS_LOG_ENABLED (debug) ) { ... }
+#define GRAPHICS_LOG_ENABLED(level)                                                                                    \
+    (::graphics::vk_utils::log_level::level >= ::graphics::vk_utils::compiled_log_level &&                             \
+     ::graphics::vk_utils::logger::instance ().enabled (::graphics::vk_utils::log_level::level))
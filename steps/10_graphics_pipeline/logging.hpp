@@ -1,6 +1,10 @@
 #pragma once
 
-#include <iostream>
+#include "logger.hpp"
+#include "validation.hpp"
+
+#include <string>
+#include <vector>
 #include <vulkan/vulkan_raii.hpp>
 
 namespace graphics
@@ -8,50 +12,36 @@ namespace graphics
 namespace vkinit
 {
 
-void log_device_properties (const vk::raii::PhysicalDevice &device)
+inline const char *device_type_name (vk::PhysicalDeviceType type)
 {
-    vk::PhysicalDeviceProperties properties = device.getProperties ();
-    std::cout << "Device name: " << properties.deviceName << std::endl;
-    std::cout << "Device type: ";
-
-    switch ( properties.deviceType )
+    switch ( type )
     {
     case vk::PhysicalDeviceType::eCpu:
-        std::cout << "CPU" << std::endl;
-        break;
+        return "CPU";
     case vk::PhysicalDeviceType::eDiscreteGpu:
-        std::cout << "Discrete GPU" << std::endl;
-        break;
+        return "Discrete GPU";
     case vk::PhysicalDeviceType::eIntegratedGpu:
-        std::cout << "Integrated GPU" << std::endl;
-        break;
+        return "Integrated GPU";
     case vk::PhysicalDeviceType::eVirtualGpu:
-        std::cout << "Virtual GPU" << std::endl;
-        break;
+        return "Virtual GPU";
     default:
-        std::cout << "Other" << std::endl;
+        return "Other";
     }
 }
 
-VKAPI_ATTR VkBool32 VKAPI_CALL debug_call_back (VkDebugUtilsMessageSeverityFlagBitsEXT messageSeverity,
-                                                VkDebugUtilsMessageTypeFlagsEXT messageType,
-                                                const VkDebugUtilsMessengerCallbackDataEXT *pCallbackData,
-                                                void *pUserData)
+void log_device_properties (const vk::PhysicalDeviceProperties &properties)
 {
-    std::cerr << "validation layer: " << pCallbackData->pMessage << std::endl;
-
-    return VK_FALSE;
+    GRAPHICS_LOG_INFO ("Device name: " << properties.deviceName.data ()
+                                       << ", type: " << device_type_name (properties.deviceType));
 }
 
-vk::raii::DebugUtilsMessengerEXT make_debug_messenger (vk::raii::Instance &instance)
+// The filter decides what reaches the log and must outlive the messenger
+vk::raii::DebugUtilsMessengerEXT make_debug_messenger (vk::raii::Instance &instance,
+                                                       vk_utils::validation_filter &filter)
 {
-    vk::DebugUtilsMessengerCreateInfoEXT createInfo {
-        vk::DebugUtilsMessengerCreateFlagsEXT (),
-        vk::DebugUtilsMessageSeverityFlagBitsEXT::eVerbose | vk::DebugUtilsMessageSeverityFlagBitsEXT::eWarning |
-            vk::DebugUtilsMessageSeverityFlagBitsEXT::eError,
-        vk::DebugUtilsMessageTypeFlagBitsEXT::eGeneral | vk::DebugUtilsMessageTypeFlagBitsEXT::eValidation |
-            vk::DebugUtilsMessageTypeFlagBitsEXT::ePerformance,
-        debug_call_back, nullptr};
+    vk::DebugUtilsMessengerCreateInfoEXT createInfo {vk::DebugUtilsMessengerCreateFlagsEXT (),
+                                                     filter.subscribed_severities (), filter.subscribed_types (),
+                                                     vk_utils::validation_filter::callback, &filter};
     return instance.createDebugUtilsMessengerEXT (createInfo);
 }
 
@@ -1,3 +1,101 @@
 #include "engine.hpp"
 
-int main () { graphics::engine (); }
\ No newline at end of file
+#include <cstring>
+#include <string>
+
+int main (int argc, char **argv)
+{
+    graphics::engine_create_info info {};
+    std::string vertex_shader_path, fragment_shader_path;
+
+    for ( int i = 1; i < argc; ++i )
+    {
+        if ( !std::strcmp (argv[i], "--headless") )
+            info.headless = true;
+        else if ( !std::strcmp (argv[i], "--frames") && i + 1 < argc )
+            info.frame_limit = std::stoull (argv[++i]);
+        else if ( !std::strcmp (argv[i], "--split-vertices") )
+            info.split_vertex_streams = true;
+        else if ( !std::strcmp (argv[i], "--objects") && i + 1 < argc )
+            info.object_count = std::stoul (argv[++i]);
+        else if ( !std::strcmp (argv[i], "--recording-threads") && i + 1 < argc )
+            info.recording_threads = std::stoul (argv[++i]);
+        else if ( !std::strcmp (argv[i], "--direct-dispatch") )
+            info.direct_dispatch = true;
+        else if ( !std::strcmp (argv[i], "--gpu-culling") )
+            info.gpu_culling = true;
+        else if ( !std::strcmp (argv[i], "--vertex-shader") && i + 1 < argc )
+            vertex_shader_path = argv[++i];
+        else if ( !std::strcmp (argv[i], "--fragment-shader") && i + 1 < argc )
+            fragment_shader_path = argv[++i];
+        else if ( !std::strcmp (argv[i], "--frames-in-flight") && i + 1 < argc )
+            info.max_frames_in_flight = std::stoul (argv[++i]);
+        else if ( !std::strcmp (argv[i], "--present") && i + 1 < argc )
+        {
+            std::string policy = argv[++i];
+            if ( policy == "low-latency" )
+                info.present_policy = graphics::vkinit::present_policy::low_latency;
+            else if ( policy == "max-throughput" )
+                info.present_policy = graphics::vkinit::present_policy::max_throughput;
+            else if ( policy == "power-saver" )
+                info.present_policy = graphics::vkinit::present_policy::power_saver;
+        }
+        else if ( !std::strcmp (argv[i], "--device-uuid") && i + 1 < argc )
+        {
+            info.device_uuid = graphics::vkinit::parse_device_uuid (argv[++i]);
+            if ( !info.device_uuid )
+                GRAPHICS_LOG_WARNING ("\"" << argv[i] << "\" is not a device UUID, ignoring it");
+        }
+        else if ( !std::strcmp (argv[i], "--validation") )
+            info.validation = true;
+        else if ( !std::strcmp (argv[i], "--validation-severity") && i + 1 < argc )
+        {
+            using severity = vk::DebugUtilsMessageSeverityFlagBitsEXT;
+
+            std::string level = argv[++i];
+            if ( level == "verbose" )
+                info.validation_settings.min_severity = severity::eVerbose;
+            else if ( level == "info" )
+                info.validation_settings.min_severity = severity::eInfo;
+            else if ( level == "warning" )
+                info.validation_settings.min_severity = severity::eWarning;
+            else if ( level == "error" )
+                info.validation_settings.min_severity = severity::eError;
+        }
+        else if ( !std::strcmp (argv[i], "--no-performance-warnings") )
+            info.validation_settings.performance_warnings = false;
+        else if ( !std::strcmp (argv[i], "--log-level") && i + 1 < argc )
+        {
+            using graphics::vk_utils::log_level;
+
+            std::string level = argv[++i];
+            if ( level == "trace" )
+                graphics::vk_utils::logger::instance ().set_level (log_level::trace);
+            else if ( level == "debug" )
+                graphics::vk_utils::logger::instance ().set_level (log_level::debug);
+            else if ( level == "info" )
+                graphics::vk_utils::logger::instance ().set_level (log_level::info);
+            else if ( level == "warning" )
+                graphics::vk_utils::logger::instance ().set_level (log_level::warning);
+            else if ( level == "error" )
+                graphics::vk_utils::logger::instance ().set_level (log_level::error);
+        }
+    }
+
+    // a headless run has no window to close, so give it a finite amount of work by default
+    if ( info.headless && !info.frame_limit )
+        info.frame_limit = 1000;
+
+    graphics::engine engine {info};
+
+    // swap in a pipeline built from SPIR-V files, they may be unmapped before the worker gets to compile it
+    if ( !vertex_shader_path.empty () && !fragment_shader_path.empty () )
+    {
+        graphics::vk_utils::mapped_file vertex_file {vertex_shader_path};
+        graphics::vk_utils::mapped_file fragment_file {fragment_shader_path};
+        engine.request_pipeline (graphics::vk_utils::as_spirv (vertex_file, vertex_shader_path),
+                                 graphics::vk_utils::as_spirv (fragment_file, fragment_shader_path));
+    }
+
+    engine.run ();
+}
\ No newline at end of file
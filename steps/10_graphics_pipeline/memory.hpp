@@ -0,0 +1,524 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <vulkan/vulkan_raii.hpp>
+
+namespace graphics
+{
+namespace vk_utils
+{
+
+/*
+ * Linear resources (buffers, linear images) and optimal images must not share a bufferImageGranularity
+ * page. Instead of padding every neighbour we keep them in separate blocks whenever the granularity is > 1.
+ */
+enum class resource_kind
+{
+    linear,
+    optimal,
+};
+
+struct allocation
+{
+    vk::DeviceMemory memory;
+    vk::DeviceSize offset = 0;
+    vk::DeviceSize size   = 0;
+    void *mapped          = nullptr;   // persistently mapped pointer for host visible memory
+    uint32_t memory_type  = 0;
+
+    bool valid () const { return static_cast<bool> (memory); }
+
+  private:
+    friend struct device_allocator;
+
+    static constexpr uint32_t dedicated = UINT32_MAX;
+    uint32_t m_block_id                 = dedicated;   // block the range lives in, or the dedicated memory id
+};
+
+struct heap_stats
+{
+    uint32_t block_count          = 0;   // vk::DeviceMemory objects, dedicated ones included
+    uint32_t allocation_count     = 0;
+    uint32_t dedicated_count      = 0;
+    vk::DeviceSize bytes_reserved = 0;   // memory taken from the driver
+    vk::DeviceSize bytes_used     = 0;   // memory handed out to resources
+};
+
+/*
+ * Grabs big vk::DeviceMemory blocks per memory type and hands out ranges of them from a first-fit free list
+ * with coalescing. Resources that are big enough to fill a good part of a block, or that the driver would
+ * rather have on their own, get a dedicated allocation. One vkAllocateMemory per resource would quickly run
+ * into maxMemoryAllocationCount and is slow on most drivers.
+ */
+struct device_allocator
+{
+    device_allocator () {}
+    device_allocator (vk::raii::Device &device, const vk::PhysicalDeviceProperties &properties,
+                      const vk::PhysicalDeviceMemoryProperties &memory_properties,
+                      vk::DeviceSize block_size = 64ull << 20)
+        : m_device {&device}, m_block_size {block_size}
+    {
+        m_memory_properties    = memory_properties;
+        m_separate_kinds       = properties.limits.bufferImageGranularity > 1;
+        m_max_allocation_count = properties.limits.maxMemoryAllocationCount;
+        m_non_coherent_atom    = properties.limits.nonCoherentAtomSize;
+        m_has_dedicated_query  = properties.apiVersion >= VK_API_VERSION_1_1;
+        m_heaps.resize (m_memory_properties.memoryHeapCount);
+    }
+
+    device_allocator (const device_allocator &)             = delete;
+    device_allocator &operator= (const device_allocator &) = delete;
+
+    allocation allocate (const vk::MemoryRequirements &requirements, vk::MemoryPropertyFlags required,
+                         vk::MemoryPropertyFlags preferred = {}, resource_kind kind = resource_kind::linear,
+                         bool prefer_dedicated = false, vk::Buffer dedicated_buffer = nullptr,
+                         vk::Image dedicated_image = nullptr)
+    {
+        std::lock_guard<std::mutex> lock {m_mutex};
+
+        bool dedicated = prefer_dedicated || requirements.size >= m_block_size / 2;
+
+        // try the types that have everything we'd like first, then the ones that merely work
+        for ( uint32_t type : candidate_types (requirements.memoryTypeBits, required, preferred) )
+        {
+            try
+            {
+                if ( dedicated )
+                    return allocate_dedicated (requirements, type, dedicated_buffer, dedicated_image);
+
+                if ( auto result = allocate_from_blocks (requirements, type, kind) )
+                    return *result;
+            } catch ( vk::OutOfDeviceMemoryError & )
+            {
+                continue;   // that heap is full, the next candidate may live in another one
+            }
+        }
+
+        throw std::runtime_error ("Failed to find device memory for an allocation of " +
+                                  std::to_string (requirements.size) + " bytes!");
+    }
+
+    void free (allocation &alloc)
+    {
+        if ( !alloc.valid () )
+            return;
+
+        std::lock_guard<std::mutex> lock {m_mutex};
+
+        heap_stats &heap = m_heaps[m_memory_properties.memoryTypes[alloc.memory_type].heapIndex];
+        heap.allocation_count--;
+        heap.bytes_used -= alloc.size;
+
+        if ( alloc.m_block_id == allocation::dedicated )
+        {
+            heap.block_count--;
+            heap.dedicated_count--;
+            heap.bytes_reserved -= alloc.size;
+            m_dedicated.erase (static_cast<VkDeviceMemory> (alloc.memory));
+        }
+        else
+            release_range (alloc);
+
+        alloc = allocation {};
+    }
+
+    // Host writes to memory without HOST_COHERENT have to be flushed before the GPU may read them
+    void flush (const allocation &alloc, vk::DeviceSize offset = 0, vk::DeviceSize size = VK_WHOLE_SIZE)
+    {
+        if ( host_coherent (alloc) )
+            return;
+
+        std::lock_guard<std::mutex> lock {m_mutex};
+        m_device->flushMappedMemoryRanges (mapped_range (alloc, offset, size));
+    }
+
+    // The other direction, GPU writes to memory without HOST_COHERENT aren't visible to the host before this
+    void invalidate (const allocation &alloc, vk::DeviceSize offset = 0, vk::DeviceSize size = VK_WHOLE_SIZE)
+    {
+        if ( host_coherent (alloc) )
+            return;
+
+        std::lock_guard<std::mutex> lock {m_mutex};
+        m_device->invalidateMappedMemoryRanges (mapped_range (alloc, offset, size));
+    }
+
+    std::vector<heap_stats> stats () const
+    {
+        std::lock_guard<std::mutex> lock {m_mutex};
+        return m_heaps;
+    }
+
+    void report (std::ostream &os) const
+    {
+        std::vector<heap_stats> heaps = stats ();
+        for ( uint32_t i = 0; i < heaps.size (); ++i )
+        {
+            if ( !heaps[i].block_count )
+                continue;
+            os << "Memory heap #" << i << ": " << heaps[i].bytes_used << " of " << heaps[i].bytes_reserved
+               << " bytes used by " << heaps[i].allocation_count << " allocation(s) in " << heaps[i].block_count
+               << " block(s), " << heaps[i].dedicated_count << " dedicated" << std::endl;
+        }
+    }
+
+    const vk::PhysicalDeviceMemoryProperties &memory_properties () const { return m_memory_properties; }
+
+    // Resource creation helpers: the returned objects give their memory back on destruction
+    template <typename resource_type> struct allocated
+    {
+        allocated () {}
+        allocated (resource_type &&resource, allocation alloc, device_allocator &allocator)
+            : m_resource {std::move (resource)}, m_allocation {alloc}, m_allocator {&allocator}
+        {}
+
+        allocated (allocated &&other) noexcept
+            : m_resource {std::move (other.m_resource)}, m_allocation {std::exchange (other.m_allocation, {})},
+              m_allocator {std::exchange (other.m_allocator, nullptr)}
+        {}
+        allocated &operator= (allocated &&other) noexcept
+        {
+            if ( this != &other )
+            {
+                release ();
+                m_resource   = std::move (other.m_resource);
+                m_allocation = std::exchange (other.m_allocation, {});
+                m_allocator  = std::exchange (other.m_allocator, nullptr);
+            }
+            return *this;
+        }
+        ~allocated () { release (); }
+
+        resource_type &operator* () { return m_resource; }
+        const resource_type &operator* () const { return m_resource; }
+        const allocation &memory () const { return m_allocation; }
+        void *mapped () const { return m_allocation.mapped; }
+
+      private:
+        resource_type m_resource {nullptr};
+        allocation m_allocation;
+        device_allocator *m_allocator = nullptr;
+
+        void release ()
+        {
+            // the resource goes first, it must not outlive the memory bound to it
+            m_resource = resource_type {nullptr};
+            if ( m_allocator )
+                m_allocator->free (m_allocation);
+            m_allocator = nullptr;
+        }
+    };
+
+    using allocated_buffer = allocated<vk::raii::Buffer>;
+    using allocated_image  = allocated<vk::raii::Image>;
+
+    allocated_buffer create_buffer (const vk::BufferCreateInfo &buffer_info, vk::MemoryPropertyFlags required,
+                                    vk::MemoryPropertyFlags preferred = {})
+    {
+        vk::raii::Buffer buffer = m_device->createBuffer (buffer_info);
+
+        vk::MemoryRequirements requirements = buffer.getMemoryRequirements ();
+        bool prefer_dedicated               = false;
+        if ( m_has_dedicated_query )
+        {
+            auto chain =
+                m_device->getBufferMemoryRequirements2<vk::MemoryRequirements2, vk::MemoryDedicatedRequirements> (
+                    vk::BufferMemoryRequirementsInfo2 {*buffer});
+            prefer_dedicated = chain.get<vk::MemoryDedicatedRequirements> ().prefersDedicatedAllocation;
+        }
+
+        allocation alloc = allocate (requirements, required, preferred, resource_kind::linear, prefer_dedicated,
+                                     *buffer, nullptr);
+        buffer.bindMemory (alloc.memory, alloc.offset);
+        return allocated_buffer {std::move (buffer), alloc, *this};
+    }
+
+    allocated_image create_image (const vk::ImageCreateInfo &image_info, vk::MemoryPropertyFlags required,
+                                  vk::MemoryPropertyFlags preferred = {})
+    {
+        vk::raii::Image image = m_device->createImage (image_info);
+
+        vk::MemoryRequirements requirements = image.getMemoryRequirements ();
+        bool prefer_dedicated               = false;
+        if ( m_has_dedicated_query )
+        {
+            auto chain =
+                m_device->getImageMemoryRequirements2<vk::MemoryRequirements2, vk::MemoryDedicatedRequirements> (
+                    vk::ImageMemoryRequirementsInfo2 {*image});
+            prefer_dedicated = chain.get<vk::MemoryDedicatedRequirements> ().prefersDedicatedAllocation;
+        }
+
+        resource_kind kind =
+            image_info.tiling == vk::ImageTiling::eLinear ? resource_kind::linear : resource_kind::optimal;
+
+        allocation alloc = allocate (requirements, required, preferred, kind, prefer_dedicated, nullptr, *image);
+        image.bindMemory (alloc.memory, alloc.offset);
+        return allocated_image {std::move (image), alloc, *this};
+    }
+
+  private:
+    struct memory_block
+    {
+        vk::raii::DeviceMemory memory {nullptr};
+        vk::DeviceSize size       = 0;
+        void *mapped              = nullptr;
+        resource_kind kind        = resource_kind::linear;
+        uint32_t type             = 0;
+        uint32_t allocation_count = 0;
+        std::map<vk::DeviceSize, vk::DeviceSize> free_ranges;   // offset -> size, sorted by offset
+    };
+
+    vk::raii::Device *m_device         = nullptr;
+    vk::DeviceSize m_block_size        = 0;
+    vk::DeviceSize m_non_coherent_atom = 1;
+    uint32_t m_max_allocation_count    = 0;
+    bool m_separate_kinds              = true;
+    bool m_has_dedicated_query         = false;
+    vk::PhysicalDeviceMemoryProperties m_memory_properties;
+
+    mutable std::mutex m_mutex;
+    uint32_t m_next_block_id = 0;
+    std::unordered_map<uint32_t, memory_block> m_blocks;
+    std::unordered_map<VkDeviceMemory, std::pair<vk::raii::DeviceMemory, vk::DeviceSize>> m_dedicated;
+    std::vector<heap_stats> m_heaps;
+
+    static vk::DeviceSize align_up (vk::DeviceSize value, vk::DeviceSize alignment)
+    {
+        return (value + alignment - 1) / alignment * alignment;
+    }
+    static vk::DeviceSize align_down (vk::DeviceSize value, vk::DeviceSize alignment)
+    {
+        return value / alignment * alignment;
+    }
+
+    vk::DeviceSize memory_size (const allocation &alloc) const
+    {
+        if ( alloc.m_block_id == allocation::dedicated )
+            return alloc.size;
+        return m_blocks.at (alloc.m_block_id).size;
+    }
+
+    bool host_coherent (const allocation &alloc) const
+    {
+        return static_cast<bool> (m_memory_properties.memoryTypes[alloc.memory_type].propertyFlags &
+                                  vk::MemoryPropertyFlagBits::eHostCoherent);
+    }
+
+    // Widened to whole nonCoherentAtomSize atoms, call with m_mutex held
+    vk::MappedMemoryRange mapped_range (const allocation &alloc, vk::DeviceSize offset, vk::DeviceSize size) const
+    {
+        vk::DeviceSize begin = align_down (alloc.offset + offset, m_non_coherent_atom);
+        vk::DeviceSize end   = size == VK_WHOLE_SIZE ? alloc.offset + alloc.size : alloc.offset + offset + size;
+        end                  = align_up (end, m_non_coherent_atom);
+
+        // the last atom of a block may be cut short by the end of the allocation
+        vk::MappedMemoryRange range {alloc.memory, begin, VK_WHOLE_SIZE};
+        if ( end < memory_size (alloc) )
+            range.size = end - begin;
+        return range;
+    }
+
+    uint32_t memory_object_count () const
+    {
+        uint32_t count = 0;
+        for ( auto &heap : m_heaps )
+            count += heap.block_count;
+        return count;
+    }
+
+    std::vector<uint32_t> candidate_types (uint32_t type_bits, vk::MemoryPropertyFlags required,
+                                           vk::MemoryPropertyFlags preferred) const
+    {
+        std::vector<uint32_t> best, acceptable;
+        for ( uint32_t i = 0; i < m_memory_properties.memoryTypeCount; ++i )
+        {
+            vk::MemoryPropertyFlags flags = m_memory_properties.memoryTypes[i].propertyFlags;
+            if ( !(type_bits & (1u << i)) || (flags & required) != required )
+                continue;
+
+            if ( (flags & preferred) == preferred )
+                best.push_back (i);
+            else
+                acceptable.push_back (i);
+        }
+        best.insert (best.end (), acceptable.begin (), acceptable.end ());
+        return best;
+    }
+
+    vk::raii::DeviceMemory allocate_memory (vk::DeviceSize size, uint32_t type, const void *next = nullptr)
+    {
+        if ( memory_object_count () >= m_max_allocation_count )
+            throw std::runtime_error ("maxMemoryAllocationCount reached!");
+
+        vk::MemoryAllocateInfo allocate_info {};
+        allocate_info.pNext           = next;
+        allocate_info.allocationSize  = size;
+        allocate_info.memoryTypeIndex = type;
+        return m_device->allocateMemory (allocate_info);
+    }
+
+    bool host_visible (uint32_t type) const
+    {
+        return static_cast<bool> (m_memory_properties.memoryTypes[type].propertyFlags &
+                                  vk::MemoryPropertyFlagBits::eHostVisible);
+    }
+
+    allocation allocate_dedicated (const vk::MemoryRequirements &requirements, uint32_t type, vk::Buffer buffer,
+                                   vk::Image image)
+    {
+        vk::MemoryDedicatedAllocateInfo dedicated_info {};
+        dedicated_info.buffer = buffer;
+        dedicated_info.image  = image;
+
+        bool has_resource             = buffer || image;
+        const void *next              = m_has_dedicated_query && has_resource ? &dedicated_info : nullptr;
+        vk::raii::DeviceMemory memory = allocate_memory (requirements.size, type, next);
+
+        allocation alloc;
+        alloc.memory      = *memory;
+        alloc.offset      = 0;
+        alloc.size        = requirements.size;
+        alloc.memory_type = type;
+        alloc.mapped      = host_visible (type) ? memory.mapMemory (0, VK_WHOLE_SIZE) : nullptr;
+
+        heap_stats &heap = m_heaps[m_memory_properties.memoryTypes[type].heapIndex];
+        heap.block_count++;
+        heap.dedicated_count++;
+        heap.allocation_count++;
+        heap.bytes_reserved += alloc.size;
+        heap.bytes_used += alloc.size;
+
+        m_dedicated.emplace (static_cast<VkDeviceMemory> (alloc.memory),
+                             std::make_pair (std::move (memory), requirements.size));
+        return alloc;
+    }
+
+    // First fit: the leftover before the aligned offset stays in the free list, as does the tail
+    static std::optional<vk::DeviceSize> take_range (memory_block &block, const vk::MemoryRequirements &requirements)
+    {
+        for ( auto it = block.free_ranges.begin (); it != block.free_ranges.end (); ++it )
+        {
+            vk::DeviceSize range_begin = it->first, range_end = it->first + it->second;
+            vk::DeviceSize offset      = align_up (range_begin, requirements.alignment);
+            if ( offset + requirements.size > range_end )
+                continue;
+
+            block.free_ranges.erase (it);
+            if ( offset > range_begin )
+                block.free_ranges.emplace (range_begin, offset - range_begin);
+            if ( offset + requirements.size < range_end )
+                block.free_ranges.emplace (offset + requirements.size, range_end - offset - requirements.size);
+            return offset;
+        }
+        return std::nullopt;
+    }
+
+    std::optional<allocation> allocate_from_blocks (const vk::MemoryRequirements &requirements, uint32_t type,
+                                                    resource_kind kind)
+    {
+        if ( !m_separate_kinds )
+            kind = resource_kind::linear;
+
+        auto make_allocation = [&] (uint32_t id, memory_block &block, vk::DeviceSize offset) {
+            allocation alloc;
+            alloc.memory      = *block.memory;
+            alloc.offset      = offset;
+            alloc.size        = requirements.size;
+            alloc.memory_type = type;
+            alloc.mapped      = block.mapped ? static_cast<char *> (block.mapped) + offset : nullptr;
+            alloc.m_block_id  = id;
+
+            block.allocation_count++;
+            heap_stats &heap = m_heaps[m_memory_properties.memoryTypes[type].heapIndex];
+            heap.allocation_count++;
+            heap.bytes_used += requirements.size;
+            return alloc;
+        };
+
+        for ( auto &[id, block] : m_blocks )
+        {
+            if ( block.type != type || block.kind != kind )
+                continue;
+            if ( auto offset = take_range (block, requirements) )
+                return make_allocation (id, block, *offset);
+        }
+
+        // no room anywhere, grab a new block
+        uint32_t id = m_next_block_id++;
+
+        memory_block block;
+        block.memory = allocate_memory (m_block_size, type);
+        block.size   = m_block_size;
+        block.mapped = host_visible (type) ? block.memory.mapMemory (0, VK_WHOLE_SIZE) : nullptr;
+        block.kind   = kind;
+        block.type   = type;
+        block.free_ranges.emplace (0, m_block_size);
+
+        heap_stats &heap = m_heaps[m_memory_properties.memoryTypes[type].heapIndex];
+        heap.block_count++;
+        heap.bytes_reserved += m_block_size;
+
+        memory_block &inserted = m_blocks.emplace (id, std::move (block)).first->second;
+        auto offset            = take_range (inserted, requirements);
+        if ( !offset )
+            return std::nullopt;
+        return make_allocation (id, inserted, *offset);
+    }
+
+    void release_range (const allocation &alloc)
+    {
+        memory_block &block = m_blocks.at (alloc.m_block_id);
+
+        vk::DeviceSize begin = alloc.offset, end = alloc.offset + alloc.size;
+
+        // merge with the free neighbours on both sides
+        auto next = block.free_ranges.lower_bound (begin);
+        if ( next != block.free_ranges.end () && next->first == end )
+        {
+            end  = next->first + next->second;
+            next = block.free_ranges.erase (next);
+        }
+        if ( next != block.free_ranges.begin () )
+        {
+            auto prev = std::prev (next);
+            if ( prev->first + prev->second == begin )
+            {
+                begin = prev->first;
+                block.free_ranges.erase (prev);
+            }
+        }
+        block.free_ranges.emplace (begin, end - begin);
+
+        // give empty blocks back to the driver, but keep one around per type to avoid thrashing
+        if ( --block.allocation_count )
+            return;
+
+        bool another_empty = std::any_of (m_blocks.begin (), m_blocks.end (), [&] (const auto &entry) {
+            return entry.first != alloc.m_block_id && entry.second.type == block.type && !entry.second.allocation_count;
+        });
+        if ( !another_empty )
+            return;
+
+        heap_stats &heap = m_heaps[m_memory_properties.memoryTypes[block.type].heapIndex];
+        heap.block_count--;
+        heap.bytes_reserved -= block.size;
+        m_blocks.erase (alloc.m_block_id);
+    }
+};
+
+using allocated_buffer = device_allocator::allocated_buffer;
+using allocated_image  = device_allocator::allocated_image;
+
+}   // namespace vk_utils
+}   // namespace graphics
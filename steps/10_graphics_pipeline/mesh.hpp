@@ -0,0 +1,204 @@
+#pragma once
+
+#include "dispatch.hpp"
+#include "memory.hpp"
+#include "staging.hpp"
+#include "vertex.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <stdexcept>
+#include <tuple>
+#include <vector>
+
+#include <vulkan/vulkan_raii.hpp>
+
+namespace graphics
+{
+namespace vk_utils
+{
+
+// Interleaved layout: everything a vertex has in one stream
+struct vertex
+{
+    std::array<float, 2> position;
+    std::array<float, 3> color;
+};
+
+// Split layout: the same attributes at the same locations, one stream each
+struct vertex_position
+{
+    std::array<float, 2> position;
+};
+
+struct vertex_color
+{
+    std::array<float, 3> color;
+};
+
+/*
+ * One object of a GPU culled draw list, fed to the vertex shader as a per-instance stream and read by the
+ * culling shader as a storage buffer, so the layout must match both shader_instanced.vert and cull.comp
+ */
+struct instance_data
+{
+    std::array<float, 2> offset = {0.0f, 0.0f};
+    float scale                 = 1.0f;
+    float radius                = 0.0f;   // bounding sphere around offset, already scaled
+};
+
+template <> struct vertex_attributes<vertex>
+{
+    static constexpr std::array value = {VK_UTILS_VERTEX_ATTRIBUTE (vertex, position, 0),
+                                         VK_UTILS_VERTEX_ATTRIBUTE (vertex, color, 1)};
+};
+
+template <> struct vertex_attributes<vertex_position>
+{
+    static constexpr std::array value = {VK_UTILS_VERTEX_ATTRIBUTE (vertex_position, position, 0)};
+};
+
+template <> struct vertex_attributes<vertex_color>
+{
+    static constexpr std::array value = {VK_UTILS_VERTEX_ATTRIBUTE (vertex_color, color, 1)};
+};
+
+template <> struct vertex_attributes<instance_data>
+{
+    static constexpr std::array value = {VK_UTILS_VERTEX_ATTRIBUTE (instance_data, offset, 2),
+                                         VK_UTILS_VERTEX_ATTRIBUTE (instance_data, scale, 3)};
+};
+
+template <> struct vertex_input_rate<instance_data>
+{
+    static constexpr vk::VertexInputRate value = vk::VertexInputRate::eInstance;
+};
+
+using interleaved_vertex_input = vertex_input<vertex>;
+using split_vertex_input       = vertex_input<vertex_position, vertex_color>;
+// the instance stream is bound right after the mesh streams
+using instanced_interleaved_vertex_input = vertex_input<vertex, instance_data>;
+using instanced_split_vertex_input       = vertex_input<vertex_position, vertex_color, instance_data>;
+
+/*
+ * Device local vertex and index buffers. All streams of a mesh share one buffer, stream i starts at
+ * m_stream_offsets[i] and is bound at binding i.
+ */
+struct mesh
+{
+    allocated_buffer m_vertices;
+    allocated_buffer m_indices;
+    std::vector<vk::DeviceSize> m_stream_offsets;
+    uint32_t m_vertex_count = 0;
+    uint32_t m_index_count  = 0;
+
+    // Binds the first stream_count streams, all of them by default
+    void bind (vk::raii::CommandBuffer &command_buffer, uint32_t stream_count = UINT32_MAX) const
+    {
+        stream_count = std::min<uint32_t> (stream_count, m_stream_offsets.size ());
+
+        std::vector<vk::Buffer> buffers (stream_count, **m_vertices);
+        command_buffer.bindVertexBuffers (
+            0, buffers, vk::ArrayProxy<const vk::DeviceSize> {stream_count, m_stream_offsets.data ()});
+        command_buffer.bindIndexBuffer (**m_indices, 0, vk::IndexType::eUint32);
+    }
+
+    void draw (vk::raii::CommandBuffer &command_buffer, uint32_t instance_count = 1) const
+    {
+        command_buffer.drawIndexed (m_index_count, instance_count, 0, 0, 0);
+    }
+
+    uint32_t stream_count () const { return static_cast<uint32_t> (m_stream_offsets.size ()); }
+
+    // more streams than any vertex_input in this step uses
+    static constexpr std::size_t max_streams = 8;
+
+    // Same as above through a device_dispatch table, without the temporary buffer list
+    void bind (const device_dispatch &dispatch, vk::CommandBuffer command_buffer,
+               uint32_t stream_count = UINT32_MAX) const
+    {
+        std::array<VkBuffer, max_streams> buffers;
+        stream_count = std::min<uint32_t> ({stream_count, static_cast<uint32_t> (m_stream_offsets.size ()),
+                                            static_cast<uint32_t> (buffers.size ())});
+        buffers.fill (static_cast<VkBuffer> (**m_vertices));
+
+        VkCommandBuffer handle = static_cast<VkCommandBuffer> (command_buffer);
+        dispatch.vkCmdBindVertexBuffers (handle, 0, stream_count, buffers.data (), m_stream_offsets.data ());
+        dispatch.vkCmdBindIndexBuffer (handle, static_cast<VkBuffer> (**m_indices), 0, VK_INDEX_TYPE_UINT32);
+    }
+
+    void draw (const device_dispatch &dispatch, vk::CommandBuffer command_buffer, uint32_t instance_count = 1) const
+    {
+        dispatch.vkCmdDrawIndexed (static_cast<VkCommandBuffer> (command_buffer), m_index_count, instance_count, 0,
+                                   0, 0);
+    }
+};
+
+// Per-draw push constants, the layout must match the push_constant block of shader.vert
+struct draw_constants
+{
+    std::array<float, 2> offset = {0.0f, 0.0f};
+    float scale                 = 1.0f;
+};
+
+struct draw_item
+{
+    const mesh *geometry = nullptr;
+    draw_constants constants;
+};
+
+/*
+ * Creates the buffers and queues their contents on the staging ring, the data reaches the GPU with the next
+ * submitted frame. Pass one vector for an interleaved mesh or one per stream for a split one, the streams
+ * must match the vertex_input of the pipeline drawing the mesh.
+ */
+template <typename... stream_types>
+mesh make_mesh (device_allocator &allocator, staging_ring &staging, const std::vector<uint32_t> &indices,
+                const std::vector<stream_types> &...streams)
+{
+    static_assert (sizeof...(stream_types) > 0, "A mesh needs at least one vertex stream");
+
+    mesh result;
+    result.m_vertex_count = static_cast<uint32_t> (std::get<0> (std::tie (streams...)).size ());
+    result.m_index_count  = static_cast<uint32_t> (indices.size ());
+
+    if ( !result.m_vertex_count || indices.empty () )
+        throw std::runtime_error ("Can't make a mesh without vertices or indices!");
+    if ( ((streams.size () != result.m_vertex_count) || ...) )
+        throw std::runtime_error ("Vertex streams of a mesh must have the same length!");
+
+    // streams are laid out back to back, each one starting on a 16 byte boundary
+    vk::DeviceSize size = 0;
+    auto place_stream   = [&] (vk::DeviceSize bytes) {
+        size = (size + 15) / 16 * 16;
+        result.m_stream_offsets.push_back (size);
+        size += bytes;
+    };
+    (place_stream (sizeof (stream_types) * streams.size ()), ...);
+
+    vk::BufferCreateInfo vertex_info {};
+    vertex_info.size        = size;
+    vertex_info.usage       = vk::BufferUsageFlagBits::eVertexBuffer | vk::BufferUsageFlagBits::eTransferDst;
+    vertex_info.sharingMode = vk::SharingMode::eExclusive;
+    result.m_vertices       = allocator.create_buffer (vertex_info, vk::MemoryPropertyFlagBits::eDeviceLocal);
+
+    vk::BufferCreateInfo index_info {};
+    index_info.size        = sizeof (uint32_t) * indices.size ();
+    index_info.usage       = vk::BufferUsageFlagBits::eIndexBuffer | vk::BufferUsageFlagBits::eTransferDst;
+    index_info.sharingMode = vk::SharingMode::eExclusive;
+    result.m_indices       = allocator.create_buffer (index_info, vk::MemoryPropertyFlagBits::eDeviceLocal);
+
+    std::size_t stream_index = 0;
+    auto upload_stream       = [&] (const auto &stream) {
+        staging.upload_buffer (stream.data (), sizeof (stream[0]) * stream.size (), **result.m_vertices,
+                               result.m_stream_offsets[stream_index++]);
+    };
+    (upload_stream (streams), ...);
+    staging.upload_buffer (indices.data (), index_info.size, **result.m_indices);
+
+    return result;
+}
+
+}   // namespace vk_utils
+}   // namespace graphics
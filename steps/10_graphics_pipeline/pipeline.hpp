@@ -1,27 +1,55 @@
 #pragma once
 
+#include "logger.hpp"
+#include "mesh.hpp"
 #include "shaders.hpp"
 
 namespace graphics
 {
 namespace vkinit
 {
+
+/*
+ * direct     - the CPU records one vkCmdDrawIndexed per draw_item, constants come from push constants
+ * gpu_culled - vk_utils::gpu_culler writes the draws, the pipeline reads vk_utils::instance_data as a per-instance
+ *              vertex stream and is drawn with vkCmdDrawIndexedIndirectCount
+ */
+enum class draw_mode
+{
+    direct,
+    gpu_culled,
+};
+
 struct graphics_pipeline_bundle_create_info
 {
     vk::raii::Device &device;
-    std::string vertex_file_path;
-    std::string fragment_file_path;
-    vk::Extent2D swapchain_extent;
+    vk_utils::spirv_code vertex_code;
+    vk_utils::spirv_code fragment_code;
     vk::Format swapchain_image_format;
+    // every pipeline should be created through the engine's cache, nullptr disables caching
+    vk::raii::PipelineCache *pipeline_cache = nullptr;
+    // shared shader modules, nullptr makes the bundle create and drop its own
+    vk_utils::shader_module_cache *shader_cache = nullptr;
+    // generated from the vertex structs, see vk_utils::vertex_input<>::state_info ()
+    vk::PipelineVertexInputStateCreateInfo vertex_input {};
+    // gpu_culled expects an instanced vertex input, e.g. vk_utils::instanced_interleaved_vertex_input
+    draw_mode mode = draw_mode::direct;
 };
 
-inline vk::raii::PipelineLayout make_pipeline_layout (vk::raii::Device &device)
+// GPU culled draws take their constants from the instance stream, so only direct draws push any
+inline vk::raii::PipelineLayout make_pipeline_layout (vk::raii::Device &device, draw_mode mode = draw_mode::direct)
 {
 
+    vk::PushConstantRange push_constants {};
+    push_constants.stageFlags = vk::ShaderStageFlagBits::eVertex;
+    push_constants.offset     = 0;
+    push_constants.size       = sizeof (vk_utils::draw_constants);
+
     vk::PipelineLayoutCreateInfo layout_info;
     layout_info.flags                  = vk::PipelineLayoutCreateFlags ();
     layout_info.setLayoutCount         = 0;
-    layout_info.pushConstantRangeCount = 0;
+    layout_info.pushConstantRangeCount = mode == draw_mode::direct ? 1 : 0;
+    layout_info.pPushConstantRanges    = mode == draw_mode::direct ? &push_constants : nullptr;
     return device.createPipelineLayout (layout_info);
 }
 
@@ -36,8 +64,8 @@ inline vk::raii::RenderPass make_renderpass (vk::raii::Device &device, vk::Forma
     color_attachment.storeOp                   = vk::AttachmentStoreOp::eStore;
     color_attachment.stencilLoadOp             = vk::AttachmentLoadOp::eDontCare;
     color_attachment.stencilStoreOp            = vk::AttachmentStoreOp::eDontCare;
-    color_attachment.initialLayout             = vk::ImageLayout::eUndefined;
-    color_attachment.finalLayout               = vk::ImageLayout::ePresentSrcKHR;
+    color_attachment.initialLayout             = vk::ImageLayout::eColorAttachmentOptimal;
+    color_attachment.finalLayout               = vk::ImageLayout::eColorAttachmentOptimal;
 
     // declare that attachment to be color buffer 0 of the framebuffer
     vk::AttachmentReference color_attachment_ref = {};
@@ -51,6 +79,9 @@ inline vk::raii::RenderPass make_renderpass (vk::raii::Device &device, vk::Forma
     subpass.colorAttachmentCount   = 1;
     subpass.pColorAttachments      = &color_attachment_ref;
 
+    // layout transitions and the dependencies around the pass are the render graph's job, the attachment
+    // enters and leaves the pass as COLOR_ATTACHMENT_OPTIMAL
+
     // create the renderpass
     vk::RenderPassCreateInfo renderpassInfo = {};
     renderpassInfo.flags                    = vk::RenderPassCreateFlags ();
@@ -58,6 +89,8 @@ inline vk::raii::RenderPass make_renderpass (vk::raii::Device &device, vk::Forma
     renderpassInfo.pAttachments             = &color_attachment;
     renderpassInfo.subpassCount             = 1;
     renderpassInfo.pSubpasses               = &subpass;
+    renderpassInfo.dependencyCount          = 0;
+    renderpassInfo.pDependencies            = nullptr;
     return device.createRenderPass (renderpassInfo);
 }
 
@@ -72,11 +105,7 @@ struct graphics_pipeline_bundle
         std::vector<vk::PipelineShaderStageCreateInfo> shader_stages;
 
         // vertex input
-        vk::PipelineVertexInputStateCreateInfo vertex_input_info {};
-        vertex_input_info.flags                           = vk::PipelineVertexInputStateCreateFlags ();
-        vertex_input_info.vertexBindingDescriptionCount   = 0;
-        vertex_input_info.vertexAttributeDescriptionCount = 0;
-        pipeline_info.pVertexInputState                   = &vertex_input_info;
+        pipeline_info.pVertexInputState = &specification.vertex_input;
 
         // input assembly
         vk::PipelineInputAssemblyStateCreateInfo input_asm_info {};
@@ -85,38 +114,34 @@ struct graphics_pipeline_bundle
         pipeline_info.pInputAssemblyState = &input_asm_info;
 
         // vertex shader
-        std::cout << "Create vertex shader module" << std::endl;
-        auto vertex_shader = vk_utils::create_module (specification.vertex_file_path, specification.device);
+        GRAPHICS_LOG_DEBUG ("Create vertex shader module");
+        vk::raii::ShaderModule vertex_shader {nullptr};
         vk::PipelineShaderStageCreateInfo vertex_shader_info {};
         vertex_shader_info.flags  = vk::PipelineShaderStageCreateFlags ();
         vertex_shader_info.stage  = vk::ShaderStageFlagBits::eVertex;
-        vertex_shader_info.module = *vertex_shader;
+        vertex_shader_info.module = vk_utils::load_shader_module (specification.device, specification.shader_cache,
+                                                                  specification.vertex_code, vertex_shader);
         vertex_shader_info.pName  = "main";
         shader_stages.push_back (vertex_shader_info);
 
-        // viewport and scissor
-        vk::Viewport viewport = {};
-
-        viewport.x         = 0.0f;
-        viewport.y         = 0.0f;
-        viewport.width     = (float)specification.swapchain_extent.width;
-        viewport.height    = (float)specification.swapchain_extent.height;
-        viewport.minDepth  = 0.0f;
-        viewport.maxDepth  = 1.0f;
-        vk::Rect2D scissor = {};
-        scissor.offset.x   = 0.0f;
-        scissor.offset.y   = 0.0f;
-        scissor.extent     = specification.swapchain_extent;
-
+        // viewport and scissor are dynamic, they are set while recording so resizes don't touch pipelines
         vk::PipelineViewportStateCreateInfo viewport_info = {};
 
         viewport_info.flags          = vk::PipelineViewportStateCreateFlags ();
         viewport_info.viewportCount  = 1;
-        viewport_info.pViewports     = &viewport;
+        viewport_info.pViewports     = nullptr;
         viewport_info.scissorCount   = 1;
-        viewport_info.pScissors      = &scissor;
+        viewport_info.pScissors      = nullptr;
         pipeline_info.pViewportState = &viewport_info;
 
+        vk::DynamicState dynamic_states[] = {vk::DynamicState::eViewport, vk::DynamicState::eScissor};
+
+        vk::PipelineDynamicStateCreateInfo dynamic_info = {};
+        dynamic_info.flags                              = vk::PipelineDynamicStateCreateFlags ();
+        dynamic_info.dynamicStateCount                  = 2;
+        dynamic_info.pDynamicStates                     = dynamic_states;
+        pipeline_info.pDynamicState                     = &dynamic_info;
+
         // rasterisation
         vk::PipelineRasterizationStateCreateInfo rasterizer = {};
 
@@ -131,13 +156,15 @@ struct graphics_pipeline_bundle
         pipeline_info.pRasterizationState  = &rasterizer;
 
         // fragment shader
-        std::cout << "Create fragment shader module" << std::endl;
+        GRAPHICS_LOG_DEBUG ("Create fragment shader module");
 
-        auto fragment_shader = vk_utils::create_module (specification.fragment_file_path, specification.device);
+        vk::raii::ShaderModule fragment_shader {nullptr};
         vk::PipelineShaderStageCreateInfo fragment_shader_info = {};
         fragment_shader_info.flags                             = vk::PipelineShaderStageCreateFlags ();
         fragment_shader_info.stage                             = vk::ShaderStageFlagBits::eFragment;
-        fragment_shader_info.module                            = *fragment_shader;
+        fragment_shader_info.module =
+            vk_utils::load_shader_module (specification.device, specification.shader_cache,
+                                          specification.fragment_code, fragment_shader);
         fragment_shader_info.pName                             = "main";
         shader_stages.push_back (fragment_shader_info);
 
@@ -172,24 +199,26 @@ struct graphics_pipeline_bundle
         pipeline_info.pColorBlendState                       = &color_blending;
 
         // pipeline layout
-        std::cout << "Create Pipeline Layout" << std::endl;
-        m_layout             = make_pipeline_layout (specification.device);
+        GRAPHICS_LOG_DEBUG ("Create Pipeline Layout");
+        m_layout             = make_pipeline_layout (specification.device, specification.mode);
         pipeline_info.layout = *m_layout;
 
         // renderpass
-        std::cout << "Create RenderPass" << std::endl;
+        GRAPHICS_LOG_DEBUG ("Create RenderPass");
         m_renderpass = make_renderpass (specification.device, specification.swapchain_image_format);
 
         // make the pipeline
-        std::cout << "Create Graphics Pipeline" << std::endl;
+        GRAPHICS_LOG_DEBUG ("Create Graphics Pipeline");
         pipeline_info.renderPass         = *m_renderpass;
         pipeline_info.subpass            = 0;
         pipeline_info.basePipelineHandle = nullptr;
-        m_pipeline                       = specification.device.createGraphicsPipeline (nullptr, pipeline_info);
+        m_pipeline = specification.device.createGraphicsPipeline (specification.pipeline_cache, pipeline_info);
+        m_mode     = specification.mode;
     }
     vk::raii::PipelineLayout m_layout {nullptr};
     vk::raii::RenderPass m_renderpass {nullptr};
     vk::raii::Pipeline m_pipeline {nullptr};
+    draw_mode m_mode = draw_mode::direct;
 };
 
 }   // namespace vkinit
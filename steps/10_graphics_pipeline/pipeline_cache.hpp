@@ -0,0 +1,112 @@
+#pragma once
+
+#include "logger.hpp"
+
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include <vulkan/vulkan_raii.hpp>
+
+namespace graphics
+{
+namespace vkinit
+{
+
+/*
+ * Every pipeline cache blob starts with a VkPipelineCacheHeaderVersionOne:
+ *      uint32_t headerSize;
+ *      uint32_t headerVersion;
+ *      uint32_t vendorID;
+ *      uint32_t deviceID;
+ *      uint8_t  pipelineCacheUUID[VK_UUID_SIZE];
+ * A blob written by another GPU or driver version is useless at best, so we refuse to hand it to the driver.
+ */
+inline bool pipeline_cache_is_compatible (const std::vector<uint8_t> &data, const vk::PhysicalDeviceProperties &properties)
+{
+    constexpr std::size_t header_size = 4 * sizeof (uint32_t) + VK_UUID_SIZE;
+    if ( data.size () < header_size )
+        return false;
+
+    uint32_t fields[4];
+    std::memcpy (fields, data.data (), sizeof (fields));
+
+    return fields[0] >= header_size && fields[1] == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+           fields[2] == properties.vendorID && fields[3] == properties.deviceID &&
+           std::memcmp (data.data () + sizeof (fields), properties.pipelineCacheUUID.data (), VK_UUID_SIZE) == 0;
+}
+
+struct pipeline_cache
+{
+    pipeline_cache () {}
+    pipeline_cache (vk::raii::Device &device, const vk::PhysicalDeviceProperties &properties, std::string path)
+        : m_path {std::move (path)}
+    {
+        std::vector<uint8_t> initial_data;
+
+        std::ifstream file (m_path, std::ios::binary);
+        if ( file.is_open () )
+        {
+            initial_data.assign (std::istreambuf_iterator<char> (file), std::istreambuf_iterator<char> ());
+
+            if ( pipeline_cache_is_compatible (initial_data, properties) )
+                GRAPHICS_LOG_INFO ("Loaded " << initial_data.size () << " bytes of pipeline cache from \"" << m_path
+                                             << "\"");
+            else
+            {
+                GRAPHICS_LOG_WARNING ("Pipeline cache \"" << m_path
+                                                            << "\" was made by another device or driver, ignoring it");
+                initial_data.clear ();
+            }
+        }
+
+        vk::PipelineCacheCreateInfo cache_info {};
+        cache_info.flags           = vk::PipelineCacheCreateFlags ();
+        cache_info.initialDataSize = initial_data.size ();
+        cache_info.pInitialData    = initial_data.data ();
+        m_impl                     = device.createPipelineCache (cache_info);
+    }
+
+    // The cache is written to a temporary file first and then renamed over the old one, so a crash
+    // in the middle of saving can never leave a truncated cache behind
+    void save () const
+    {
+        if ( !*m_impl || m_path.empty () )
+            return;
+
+        std::vector<uint8_t> data = m_impl.getData ();
+        std::string tmp_path      = m_path + ".tmp";
+
+        std::error_code error;
+        std::ofstream file (tmp_path, std::ios::binary | std::ios::trunc);
+        file.write (reinterpret_cast<const char *> (data.data ()), data.size ());
+        // the final flush happens in close (), so only a closed stream tells whether everything got written
+        file.close ();
+        if ( file.fail () )
+        {
+            GRAPHICS_LOG_WARNING ("Failed to write pipeline cache to \"" << tmp_path << "\"");
+            std::filesystem::remove (tmp_path, error);
+            return;
+        }
+
+        std::filesystem::rename (tmp_path, m_path, error);
+        if ( error )
+        {
+            GRAPHICS_LOG_WARNING ("Failed to save pipeline cache to \"" << m_path << "\": " << error.message ());
+            std::filesystem::remove (tmp_path, error);
+            return;
+        }
+
+        GRAPHICS_LOG_INFO ("Saved " << data.size () << " bytes of pipeline cache to \"" << m_path << "\"");
+    }
+
+    vk::raii::PipelineCache m_impl {nullptr};
+    std::string m_path;
+};
+
+}   // namespace vkinit
+}   // namespace graphics
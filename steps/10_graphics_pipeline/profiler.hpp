@@ -0,0 +1,294 @@
+#pragma once
+
+#include "logger.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <vulkan/vulkan_raii.hpp>
+
+namespace graphics
+{
+namespace vk_utils
+{
+
+// Wall clock durations of consecutive CPU stages, e.g. the steps of engine startup
+struct stage_timer
+{
+    struct stage
+    {
+        std::string name;
+        double milliseconds = 0.0;
+    };
+
+    stage_timer () : m_last {clock::now ()} {}
+
+    void restart ()
+    {
+        m_stages.clear ();
+        m_last = clock::now ();
+    }
+
+    // Closes the stage that began at the previous mark () or restart ()
+    void mark (std::string name)
+    {
+        clock::time_point now = clock::now ();
+        std::chrono::duration<double, std::milli> elapsed = now - m_last;
+        m_stages.push_back (stage {std::move (name), elapsed.count ()});
+        m_last = now;
+    }
+
+    const std::vector<stage> &stages () const { return m_stages; }
+
+    double total_ms () const
+    {
+        double total = 0.0;
+        for ( auto &stage : m_stages )
+            total += stage.milliseconds;
+        return total;
+    }
+
+  private:
+    using clock = std::chrono::steady_clock;   // monotonic, unlike system_clock
+
+    clock::time_point m_last;
+    std::vector<stage> m_stages;
+};
+
+inline double median (std::vector<double> samples)
+{
+    if ( samples.empty () )
+        return 0.0;
+
+    std::sort (samples.begin (), samples.end ());
+    std::size_t middle = samples.size () / 2;
+    return samples.size () % 2 ? samples[middle] : (samples[middle - 1] + samples[middle]) / 2.0;
+}
+
+// Nearest-rank percentile, always one of the measured values
+inline double percentile (std::vector<double> samples, double fraction)
+{
+    if ( samples.empty () )
+        return 0.0;
+
+    std::sort (samples.begin (), samples.end ());
+    std::size_t rank = static_cast<std::size_t> (std::ceil (fraction * samples.size ()));
+    return samples[std::clamp<std::size_t> (rank, 1, samples.size ()) - 1];
+}
+
+// Repeated wall clock measurements of one thing, e.g. a startup stage over many benchmark runs
+struct sample_series
+{
+    std::string name;
+    std::vector<double> milliseconds;
+
+    std::size_t count () const { return milliseconds.size (); }
+    double median_ms () const { return median (milliseconds); }
+    double percentile_ms (double fraction) const { return percentile (milliseconds, fraction); }
+    double min_ms () const { return count () ? *std::min_element (milliseconds.begin (), milliseconds.end ()) : 0.0; }
+    double max_ms () const { return count () ? *std::max_element (milliseconds.begin (), milliseconds.end ()) : 0.0; }
+};
+
+// Appends to the series called name, creating it at the end if there is none yet
+inline void add_sample (std::vector<sample_series> &series, const std::string &name, double milliseconds)
+{
+    auto found = std::find_if (series.begin (), series.end (),
+                               [&name] (const sample_series &entry) { return entry.name == name; });
+    if ( found == series.end () )
+        found = series.insert (series.end (), sample_series {name, {}});
+    found->milliseconds.push_back (milliseconds);
+}
+
+struct scope_stats
+{
+    std::string name;
+    double min_ms    = std::numeric_limits<double>::max ();
+    double max_ms    = 0.0;
+    double total_ms  = 0.0;
+    uint64_t samples = 0;
+
+    double avg_ms () const { return samples ? total_ms / samples : 0.0; }
+};
+
+/*
+ * Every frame in flight owns its own timestamp query pool. The pool of a frame slot is read back right
+ * before that slot is recorded again, i.e. after its timeline value has been waited on, so the results
+ * are always available and reading them never stalls the CPU.
+ */
+struct gpu_profiler
+{
+    gpu_profiler () {}
+    gpu_profiler (vk::raii::Device &device, uint32_t frames_in_flight, float timestamp_period,
+                  uint32_t timestamp_valid_bits, uint32_t max_scopes = 32)
+        : m_period {timestamp_period}, m_max_scopes {max_scopes}
+    {
+        // a queue family without valid bits can't write timestamps at all
+        if ( !timestamp_valid_bits )
+        {
+            GRAPHICS_LOG_WARNING ("Timestamps are not supported by the graphics queue, GPU profiling is disabled");
+            return;
+        }
+
+        m_valid_mask = timestamp_valid_bits >= 64 ? ~uint64_t {0} : (uint64_t {1} << timestamp_valid_bits) - 1;
+
+        vk::QueryPoolCreateInfo pool_info {};
+        pool_info.flags      = vk::QueryPoolCreateFlags ();
+        pool_info.queryType  = vk::QueryType::eTimestamp;
+        pool_info.queryCount = 2 * m_max_scopes;
+
+        m_frames.reserve (frames_in_flight);
+        for ( uint32_t i = 0; i < frames_in_flight; ++i )
+            m_frames.push_back (frame_queries {device.createQueryPool (pool_info)});
+    }
+
+    bool enabled () const { return !m_frames.empty (); }
+
+    // Collects the results this frame slot produced last time and resets its pool, must be recorded
+    // outside of a render pass
+    void begin_frame (vk::raii::CommandBuffer &command_buffer, uint32_t frame_index)
+    {
+        if ( !enabled () )
+            return;
+
+        m_current         = frame_index;
+        frame_queries &fq = m_frames[m_current];
+
+        collect (fq);
+
+        command_buffer.resetQueryPool (*fq.pool, 0, 2 * m_max_scopes);
+        fq.scopes.clear ();
+    }
+
+    uint32_t begin_scope (vk::raii::CommandBuffer &command_buffer, const std::string &name)
+    {
+        if ( !enabled () )
+            return 0;
+
+        frame_queries &fq = m_frames[m_current];
+        if ( fq.scopes.size () >= m_max_scopes )
+            return invalid_scope;
+
+        uint32_t slot = static_cast<uint32_t> (fq.scopes.size ());
+        fq.scopes.push_back (stats_index (name));
+        command_buffer.writeTimestamp (vk::PipelineStageFlagBits::eTopOfPipe, *fq.pool, 2 * slot);
+        return slot;
+    }
+
+    void end_scope (vk::raii::CommandBuffer &command_buffer, uint32_t slot)
+    {
+        if ( !enabled () || slot == invalid_scope )
+            return;
+
+        command_buffer.writeTimestamp (vk::PipelineStageFlagBits::eBottomOfPipe, *m_frames[m_current].pool,
+                                       2 * slot + 1);
+    }
+
+    // RAII helper: the region between construction and destruction is timed
+    struct scope
+    {
+        scope (gpu_profiler &profiler, vk::raii::CommandBuffer &command_buffer, const std::string &name)
+            : m_profiler {profiler}, m_command_buffer {command_buffer},
+              m_slot {profiler.begin_scope (command_buffer, name)}
+        {}
+        ~scope () { m_profiler.end_scope (m_command_buffer, m_slot); }
+
+        scope (const scope &)             = delete;
+        scope &operator= (const scope &) = delete;
+
+      private:
+        gpu_profiler &m_profiler;
+        vk::raii::CommandBuffer &m_command_buffer;
+        uint32_t m_slot;
+    };
+
+    const std::vector<scope_stats> &stats () const { return m_stats; }
+
+    void report (std::ostream &os) const
+    {
+        if ( !enabled () )
+            return;
+
+        os << "GPU timings (ms):" << std::endl;
+        for ( auto &stat : m_stats )
+        {
+            if ( !stat.samples )
+                continue;
+            os << std::fixed << std::setprecision (4) << '\t' << stat.name << ": min " << stat.min_ms << ", avg "
+               << stat.avg_ms () << ", max " << stat.max_ms << " (" << stat.samples << " samples)" << std::endl;
+        }
+        os << std::defaultfloat;
+    }
+
+    static constexpr uint32_t invalid_scope = std::numeric_limits<uint32_t>::max ();
+
+  private:
+    struct frame_queries
+    {
+        vk::raii::QueryPool pool {nullptr};
+        std::vector<uint32_t> scopes;   // indices into m_stats, one per begin/end pair
+    };
+
+    float m_period        = 1.0f;   // nanoseconds per tick
+    uint32_t m_max_scopes = 0;
+    uint32_t m_current    = 0;
+    uint64_t m_valid_mask = 0;
+    std::vector<frame_queries> m_frames;
+    std::vector<scope_stats> m_stats;
+    std::unordered_map<std::string, uint32_t> m_stats_indices;
+
+    uint32_t stats_index (const std::string &name)
+    {
+        auto found = m_stats_indices.find (name);
+        if ( found != m_stats_indices.end () )
+            return found->second;
+
+        uint32_t index = static_cast<uint32_t> (m_stats.size ());
+        m_stats_indices.emplace (name, index);
+        m_stats.push_back (scope_stats {name});
+        return index;
+    }
+
+    void collect (frame_queries &fq)
+    {
+        if ( fq.scopes.empty () )
+            return;
+
+        uint32_t query_count = 2 * static_cast<uint32_t> (fq.scopes.size ());
+
+        // every query is followed by its availability word, so a scope that never ended is simply skipped
+        auto [result, data] = fq.pool.getResults<uint64_t> (
+            0, query_count, query_count * 2 * sizeof (uint64_t), 2 * sizeof (uint64_t),
+            vk::QueryResultFlagBits::e64 | vk::QueryResultFlagBits::eWithAvailability);
+
+        if ( result != vk::Result::eSuccess && result != vk::Result::eNotReady )
+            return;
+
+        for ( std::size_t slot = 0; slot < fq.scopes.size (); ++slot )
+        {
+            uint64_t begin = data[4 * slot], begin_available = data[4 * slot + 1];
+            uint64_t end = data[4 * slot + 2], end_available = data[4 * slot + 3];
+            if ( !begin_available || !end_available )
+                continue;
+
+            uint64_t ticks = ((end & m_valid_mask) - (begin & m_valid_mask)) & m_valid_mask;
+            double ms      = ticks * static_cast<double> (m_period) / 1e6;
+
+            scope_stats &stat = m_stats[fq.scopes[slot]];
+            stat.min_ms       = std::min (stat.min_ms, ms);
+            stat.max_ms       = std::max (stat.max_ms, ms);
+            stat.total_ms += ms;
+            ++stat.samples;
+        }
+    }
+};
+
+}   // namespace vk_utils
+}   // namespace graphics
@@ -1,6 +1,11 @@
 #pragma once
 
+#include "capabilities.hpp"
+#include "logger.hpp"
+
+#include <algorithm>
 #include <optional>
+#include <vector>
 
 namespace graphics
 {
@@ -11,49 +16,102 @@ struct queue_family_indices
 {
     std::optional<uint32_t> graphics_family;
     std::optional<uint32_t> present_family;
+    // families without graphics, only set when the device has them
+    std::optional<uint32_t> transfer_family;   // transfer only, usually backed by the copy engines
+    std::optional<uint32_t> compute_family;    // compute (and transfer), runs next to graphics work
 
     bool complete () { return graphics_family.has_value () && present_family.has_value (); }
+
+    std::vector<uint32_t> unique_families () const
+    {
+        std::vector<uint32_t> families;
+        for ( auto &family : {graphics_family, present_family, transfer_family, compute_family} )
+            if ( family && std::find (families.begin (), families.end (), *family) == families.end () )
+                families.push_back (*family);
+        return families;
+    }
 };
 
-static queue_family_indices find_queue_families (const vk::raii::PhysicalDevice &device, vk::raii::SurfaceKHR &surface)
+/*
+ * Looks at every family instead of stopping at the first complete set: a family that can both render and
+ * present is preferred, and the families that are transfer-only or compute-only are picked up when they exist
+ */
+static queue_family_indices find_queue_families (const device_capabilities &capabilities)
 {
     queue_family_indices indices;
 
-    std::vector<vk::QueueFamilyProperties> queue_families = device.getQueueFamilyProperties ();
+    const std::vector<vk::QueueFamilyProperties> &queue_families = capabilities.queue_families;
 
-    std::cout << "Our physical device can support " << queue_families.size () << " queue families" << std::endl;
+    GRAPHICS_LOG_DEBUG ("Our physical device can support " << queue_families.size () << " queue families");
 
-    int i = 0;
-    for ( auto &queue_family : queue_families )
+    bool graphics_presents = false;
+    for ( uint32_t i = 0; i < queue_families.size (); ++i )
     {
-        if ( queue_family.queueFlags & vk::QueueFlagBits::eGraphics )
+        vk::QueueFlags flags = queue_families[i].queueFlags;
+        bool graphics        = static_cast<bool> (flags & vk::QueueFlagBits::eGraphics);
+        bool compute         = static_cast<bool> (flags & vk::QueueFlagBits::eCompute);
+        bool transfer        = static_cast<bool> (flags & vk::QueueFlagBits::eTransfer);
+        bool present         = i < capabilities.surface.present.size () && capabilities.surface.present[i];
+
+        if ( graphics && (!indices.graphics_family || (present && !graphics_presents)) )
         {
             indices.graphics_family = i;
+            graphics_presents       = present;
 
-            std::cout << "Queue family #" << i << " is suitable for graphics" << std::endl;
+            GRAPHICS_LOG_DEBUG ("Queue family #" << i << " is suitable for graphics");
         }
 
-        if ( device.getSurfaceSupportKHR (i, *surface) )
+        if ( present && (!indices.present_family || indices.graphics_family == i) )
         {
             indices.present_family = i;
 
-            std::cout << "Queue family #" << i << " is suitable for presenting" << std::endl;
+            GRAPHICS_LOG_DEBUG ("Queue family #" << i << " is suitable for presenting");
+        }
+
+        if ( transfer && !graphics && !compute && !indices.transfer_family )
+        {
+            indices.transfer_family = i;
+
+            GRAPHICS_LOG_DEBUG ("Queue family #" << i << " is a dedicated transfer family");
         }
 
-        if ( indices.complete () )
-            return indices;
-        i++;
+        if ( compute && !graphics && !indices.compute_family )
+        {
+            indices.compute_family = i;
+
+            GRAPHICS_LOG_DEBUG ("Queue family #" << i << " is a dedicated compute family");
+        }
     }
 
     return indices;
 }
 
-static std::vector<vk::raii::Queue> get_queue (vk::raii::PhysicalDevice &p_device, vk::raii::Device &l_device,
-                                               vk::raii::SurfaceKHR &surface)
+// One queue of every family the logical device was created with. Without a dedicated family the transfer
+// and compute queues are the graphics queue, so callers never have to check before submitting.
+struct device_queues
+{
+    queue_family_indices families;
+    vk::raii::Queue graphics = nullptr;
+    vk::raii::Queue present  = nullptr;
+    vk::raii::Queue transfer = nullptr;
+    vk::raii::Queue compute  = nullptr;
+
+    uint32_t transfer_family () const { return families.transfer_family.value_or (families.graphics_family.value ()); }
+    uint32_t compute_family () const { return families.compute_family.value_or (families.graphics_family.value ()); }
+
+    bool dedicated_transfer () const { return families.transfer_family.has_value (); }
+    bool dedicated_compute () const { return families.compute_family.has_value (); }
+};
+
+static device_queues get_queues (vk::raii::Device &l_device, const queue_family_indices &families)
 {
-    queue_family_indices indices = find_queue_families (p_device, surface);
-    return {l_device.getQueue (indices.graphics_family.value (), 0),
-            l_device.getQueue (indices.present_family.value (), 0)};
+    device_queues queues;
+    queues.families = families;
+    queues.graphics = l_device.getQueue (queues.families.graphics_family.value (), 0);
+    queues.present  = l_device.getQueue (queues.families.present_family.value (), 0);
+    queues.transfer = l_device.getQueue (queues.transfer_family (), 0);
+    queues.compute  = l_device.getQueue (queues.compute_family (), 0);
+    return queues;
 }
 
 }   // namespace vkinit
@@ -0,0 +1,127 @@
+#pragma once
+
+#include "commands.hpp"
+#include "worker_pool.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <exception>
+#include <utility>
+#include <vector>
+
+#include <vulkan/vulkan_raii.hpp>
+
+namespace graphics
+{
+namespace vk_utils
+{
+
+/*
+ * Records a draw list into secondary command buffers on a pool of worker threads. Each recording context
+ * owns one command pool per frame in flight and records one contiguous slice of the list, so no pool is
+ * ever touched by two threads at once. The primary buffer executes the secondaries in slice order, which
+ * keeps the submitted command stream identical to single-threaded recording.
+ */
+struct parallel_recorder
+{
+    parallel_recorder (vk::raii::Device &device, uint32_t queue_family_index, uint32_t frames_in_flight,
+                       uint32_t thread_count = worker_pool::default_thread_count (), uint32_t min_slice_size = 64)
+        : m_workers {thread_count}, m_min_slice_size {std::max (min_slice_size, 1u)}
+    {
+        m_contexts.resize (frames_in_flight);
+        for ( auto &frame_contexts : m_contexts )
+        {
+            frame_contexts.reserve (thread_count);
+            for ( uint32_t i = 0; i < thread_count; ++i )
+            {
+                recording_context context;
+                // no eResetCommandBuffer, the whole pool is recycled once per frame instead
+                context.pool           = vkinit::make_command_pool (device, queue_family_index);
+                context.command_buffer = vkinit::make_command_buffer (device, context.pool,
+                                                                      vk::CommandBufferLevel::eSecondary);
+                frame_contexts.push_back (std::move (context));
+            }
+        }
+    }
+
+    parallel_recorder (const parallel_recorder &)             = delete;
+    parallel_recorder &operator= (const parallel_recorder &) = delete;
+
+    uint32_t thread_count () const { return static_cast<uint32_t> (m_workers.size ()); }
+
+    /*
+     * Splits [0, item_count) into slices, calls record_slice (command_buffer, begin, end) for each one on a worker
+     * and executes the results in the primary, which must be inside a render pass begun with
+     * eSecondaryCommandBuffers. Secondaries inherit nothing but the render pass, so record_slice () has to bind
+     * the pipeline and set dynamic state itself. Only call once the previous submission of frame_index has completed.
+     */
+    template <typename record_function>
+    void record (vk::raii::CommandBuffer &primary, uint32_t frame_index, uint32_t item_count,
+                 const vk::CommandBufferInheritanceInfo &inheritance, const record_function &record_slice)
+    {
+        if ( !item_count )
+            return;
+
+        std::vector<recording_context> &contexts = m_contexts[frame_index];
+
+        uint32_t slice_count = std::min<uint32_t> (static_cast<uint32_t> (contexts.size ()),
+                                                   (item_count + m_min_slice_size - 1) / m_min_slice_size);
+
+        for ( uint32_t i = 0; i < slice_count; ++i )
+        {
+            recording_context &context = contexts[i];
+            uint32_t begin             = static_cast<uint64_t> (item_count) * i / slice_count;
+            uint32_t end               = static_cast<uint64_t> (item_count) * (i + 1) / slice_count;
+
+            m_workers.submit ([&context, &inheritance, &record_slice, begin, end] {
+                try
+                {
+                    context.pool.reset ();
+
+                    vk::CommandBufferBeginInfo begin_info {};
+                    begin_info.flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit |
+                                       vk::CommandBufferUsageFlagBits::eRenderPassContinue;
+                    begin_info.pInheritanceInfo = &inheritance;
+
+                    context.command_buffer.begin (begin_info);
+                    record_slice (context.command_buffer, begin, end);
+                    context.command_buffer.end ();
+                } catch ( ... )
+                {
+                    context.error = std::current_exception ();
+                }
+            });
+        }
+        m_workers.wait_idle ();
+
+        std::exception_ptr error;
+        std::vector<vk::CommandBuffer> secondaries;
+        secondaries.reserve (slice_count);
+        for ( uint32_t i = 0; i < slice_count; ++i )
+        {
+            if ( contexts[i].error && !error )
+                error = contexts[i].error;
+            contexts[i].error = nullptr;
+            secondaries.push_back (*contexts[i].command_buffer);
+        }
+        if ( error )
+            std::rethrow_exception (error);
+
+        primary.executeCommands (secondaries);
+    }
+
+  private:
+    struct recording_context
+    {
+        vk::raii::CommandPool pool {nullptr};
+        vk::raii::CommandBuffer command_buffer {nullptr};
+        std::exception_ptr error;
+    };
+
+    worker_pool m_workers;
+    uint32_t m_min_slice_size = 64;
+    std::vector<std::vector<recording_context>> m_contexts;   // [frame in flight][thread]
+};
+
+}   // namespace vk_utils
+}   // namespace graphics
@@ -0,0 +1,279 @@
+#include "capabilities.hpp"
+#include "commands.hpp"
+#include "device.hpp"
+#include "dispatch.hpp"
+#include "instance.hpp"
+#include "logger.hpp"
+#include "memory.hpp"
+#include "mesh.hpp"
+#include "pipeline.hpp"
+#include "profiler.hpp"
+#include "queues.hpp"
+#include "shaders.hpp"
+
+#include "shaders/fragment_spv.hpp"
+#include "shaders/vertex_spv.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+/*
+ * Records the same draw list into a secondary command buffer through each way of calling into the driver and
+ * reports how long recording took:
+ *     raii   - vk::raii::CommandBuffer methods, what the engine uses by default
+ *     loader - the vkCmd* functions exported by the Vulkan loader, every call goes through a trampoline
+ *     direct - a vk_utils::device_dispatch table, what --direct-dispatch switches the engine to
+ * Every draw pushes its constants and issues one vkCmdDrawIndexed, like engine::record_draw_items (). Nothing is
+ * ever submitted, so the buffers are left uninitialized. Works on a software ICD such as lavapipe, e.g.
+ *
+ *     VK_ICD_FILENAMES=/usr/share/vulkan/icd.d/lvp_icd.x86_64.json \
+ *         ./10_graphics_pipeline_recording_benchmark --draws 1000000 --runs 10
+ */
+
+namespace
+{
+
+using namespace graphics;
+
+struct recording_setup
+{
+    vk::raii::Device &device;
+    const vkinit::graphics_pipeline_bundle &bundle;
+    const vk_utils::mesh &geometry;
+    const vk_utils::device_dispatch &dispatch;
+    uint32_t draw_count;
+};
+
+vk_utils::draw_constants constants_of (uint32_t draw)
+{
+    // a 64x64 grid of small quads, like the engine's object grid
+    vk_utils::draw_constants constants;
+    constants.offset = {static_cast<float> (draw % 64) / 32.0f - 1.0f,
+                        static_cast<float> (draw / 64 % 64) / 32.0f - 1.0f};
+    constants.scale  = 1.0f / 64.0f;
+    return constants;
+}
+
+void record_raii (const recording_setup &setup, vk::raii::CommandBuffer &command_buffer)
+{
+    command_buffer.bindPipeline (vk::PipelineBindPoint::eGraphics, *setup.bundle.m_pipeline);
+    command_buffer.setViewport (0, vk::Viewport {0.0f, 0.0f, 64.0f, 64.0f, 0.0f, 1.0f});
+    command_buffer.setScissor (0, vk::Rect2D {{0, 0}, {64, 64}});
+    setup.geometry.bind (command_buffer);
+
+    for ( uint32_t i = 0; i < setup.draw_count; ++i )
+    {
+        command_buffer.pushConstants<vk_utils::draw_constants> (*setup.bundle.m_layout,
+                                                                vk::ShaderStageFlagBits::eVertex, 0, constants_of (i));
+        setup.geometry.draw (command_buffer);
+    }
+}
+
+void record_loader (const recording_setup &setup, vk::raii::CommandBuffer &command_buffer)
+{
+    VkCommandBuffer handle  = static_cast<VkCommandBuffer> (*command_buffer);
+    VkPipelineLayout layout = static_cast<VkPipelineLayout> (*setup.bundle.m_layout);
+
+    VkViewport viewport = {0.0f, 0.0f, 64.0f, 64.0f, 0.0f, 1.0f};
+    VkRect2D scissor    = {{0, 0}, {64, 64}};
+    VkBuffer vertices   = static_cast<VkBuffer> (**setup.geometry.m_vertices);
+    ::vkCmdBindPipeline (handle, VK_PIPELINE_BIND_POINT_GRAPHICS, static_cast<VkPipeline> (*setup.bundle.m_pipeline));
+    ::vkCmdSetViewport (handle, 0, 1, &viewport);
+    ::vkCmdSetScissor (handle, 0, 1, &scissor);
+    ::vkCmdBindVertexBuffers (handle, 0, 1, &vertices, setup.geometry.m_stream_offsets.data ());
+    ::vkCmdBindIndexBuffer (handle, static_cast<VkBuffer> (**setup.geometry.m_indices), 0, VK_INDEX_TYPE_UINT32);
+
+    for ( uint32_t i = 0; i < setup.draw_count; ++i )
+    {
+        vk_utils::draw_constants constants = constants_of (i);
+        ::vkCmdPushConstants (handle, layout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof (constants), &constants);
+        ::vkCmdDrawIndexed (handle, setup.geometry.m_index_count, 1, 0, 0, 0);
+    }
+}
+
+void record_direct (const recording_setup &setup, vk::raii::CommandBuffer &command_buffer)
+{
+    const vk_utils::device_dispatch &dispatch = setup.dispatch;
+    VkCommandBuffer handle                    = static_cast<VkCommandBuffer> (*command_buffer);
+    VkPipelineLayout layout                   = static_cast<VkPipelineLayout> (*setup.bundle.m_layout);
+
+    VkViewport viewport = {0.0f, 0.0f, 64.0f, 64.0f, 0.0f, 1.0f};
+    VkRect2D scissor    = {{0, 0}, {64, 64}};
+    dispatch.vkCmdBindPipeline (handle, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                                static_cast<VkPipeline> (*setup.bundle.m_pipeline));
+    dispatch.vkCmdSetViewport (handle, 0, 1, &viewport);
+    dispatch.vkCmdSetScissor (handle, 0, 1, &scissor);
+    setup.geometry.bind (dispatch, *command_buffer);
+
+    for ( uint32_t i = 0; i < setup.draw_count; ++i )
+    {
+        vk_utils::draw_constants constants = constants_of (i);
+        dispatch.vkCmdPushConstants (handle, layout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof (constants), &constants);
+        setup.geometry.draw (dispatch, *command_buffer);
+    }
+}
+
+// Device local buffers big enough for one quad, recording never looks at their contents
+vk_utils::mesh make_unfilled_quad (vk_utils::device_allocator &allocator)
+{
+    vk_utils::mesh quad;
+    quad.m_vertex_count   = 4;
+    quad.m_index_count    = 6;
+    quad.m_stream_offsets = {0};
+
+    vk::BufferCreateInfo vertex_info {};
+    vertex_info.size        = sizeof (vk_utils::vertex) * quad.m_vertex_count;
+    vertex_info.usage       = vk::BufferUsageFlagBits::eVertexBuffer;
+    vertex_info.sharingMode = vk::SharingMode::eExclusive;
+    quad.m_vertices         = allocator.create_buffer (vertex_info, vk::MemoryPropertyFlagBits::eDeviceLocal);
+
+    vk::BufferCreateInfo index_info {};
+    index_info.size        = sizeof (uint32_t) * quad.m_index_count;
+    index_info.usage       = vk::BufferUsageFlagBits::eIndexBuffer;
+    index_info.sharingMode = vk::SharingMode::eExclusive;
+    quad.m_indices         = allocator.create_buffer (index_info, vk::MemoryPropertyFlagBits::eDeviceLocal);
+    return quad;
+}
+
+}   // namespace
+
+int main (int argc, char **argv)
+{
+    uint32_t draw_count  = 1000000;
+    uint32_t runs        = 10;
+    uint32_t warmup_runs = 2;
+    std::string format   = "csv";
+    std::string output_path;
+    std::optional<vkinit::device_uuid> device_uuid;
+
+    for ( int i = 1; i < argc; ++i )
+    {
+        if ( !std::strcmp (argv[i], "--draws") && i + 1 < argc )
+            draw_count = std::max (std::stoul (argv[++i]), 1ul);
+        else if ( !std::strcmp (argv[i], "--runs") && i + 1 < argc )
+            runs = std::max (std::stoul (argv[++i]), 1ul);
+        else if ( !std::strcmp (argv[i], "--warmup") && i + 1 < argc )
+            warmup_runs = std::stoul (argv[++i]);
+        else if ( !std::strcmp (argv[i], "--format") && i + 1 < argc )
+            format = argv[++i];
+        else if ( !std::strcmp (argv[i], "--output") && i + 1 < argc )
+            output_path = argv[++i];
+        else if ( !std::strcmp (argv[i], "--device-uuid") && i + 1 < argc )
+            device_uuid = vkinit::parse_device_uuid (argv[++i]);
+    }
+
+    if ( format != "csv" && format != "json" )
+    {
+        std::cerr << "Unknown format \"" << format << "\", expected csv or json" << std::endl;
+        return 1;
+    }
+
+    vk_utils::logger::instance ().set_level (vk_utils::log_level::warning);
+
+    // the same device selection as the engine, minus the window and the swapchain
+    vk::raii::Instance instance = vkinit::make_instance ("draw recording benchmark", true);
+    vkinit::capability_cache capability_cache;
+    vk::raii::PhysicalDevice phys_device =
+        vkinit::choose_phys_device (instance, capability_cache, vkinit::device_preferences {device_uuid});
+    vkinit::device_capabilities capabilities = capability_cache.get (phys_device);
+
+    vk::raii::SurfaceKHR surface = vkinit::create_headless_surface (instance);
+    capabilities.query_surface (phys_device, surface);
+    vkinit::queue_family_indices families = vkinit::find_queue_families (capabilities);
+    vk::raii::Device device               = vkinit::create_logical_device (phys_device, families, capabilities);
+
+    vk_utils::device_allocator allocator {device, capabilities.properties, capabilities.memory};
+    vk_utils::mesh quad = make_unfilled_quad (allocator);
+
+    vkinit::graphics_pipeline_bundle_create_info pipeline_info {device,
+                                                                vk_utils::as_spirv (shaders::vertex_spv),
+                                                                vk_utils::as_spirv (shaders::fragment_spv),
+                                                                vk::Format::eB8G8R8A8Srgb,
+                                                                nullptr,
+                                                                nullptr,
+                                                                vk_utils::interleaved_vertex_input::state_info ()};
+    vkinit::graphics_pipeline_bundle bundle {pipeline_info};
+
+    vk_utils::device_dispatch dispatch {device};
+    recording_setup setup {device, bundle, quad, dispatch, draw_count};
+
+    vk::raii::CommandPool pool = vkinit::make_command_pool (device, *families.graphics_family);
+    vk::raii::CommandBuffer command_buffer =
+        vkinit::make_command_buffer (device, pool, vk::CommandBufferLevel::eSecondary);
+
+    vk::CommandBufferInheritanceInfo inheritance {};
+    inheritance.renderPass = *bundle.m_renderpass;
+    inheritance.subpass    = 0;
+
+    vk::CommandBufferBeginInfo begin_info {};
+    begin_info.flags =
+        vk::CommandBufferUsageFlagBits::eOneTimeSubmit | vk::CommandBufferUsageFlagBits::eRenderPassContinue;
+    begin_info.pInheritanceInfo = &inheritance;
+
+    using record_function = void (*) (const recording_setup &, vk::raii::CommandBuffer &);
+    std::vector<std::pair<vk_utils::sample_series, record_function>> modes = {
+        {{"raii", {}}, record_raii}, {{"loader", {}}, record_loader}, {{"direct", {}}, record_direct}};
+
+    // modes take turns on every run, so clock and thermal drift hit all of them alike
+    for ( uint32_t run = 0; run < warmup_runs + runs; ++run )
+    {
+        for ( auto &[samples, record] : modes )
+        {
+            using clock        = std::chrono::steady_clock;
+            using milliseconds = std::chrono::duration<double, std::milli>;
+
+            pool.reset ();
+            clock::time_point start = clock::now ();
+            command_buffer.begin (begin_info);
+            record (setup, command_buffer);
+            command_buffer.end ();
+            milliseconds recording = clock::now () - start;
+
+            if ( run >= warmup_runs )
+                samples.milliseconds.push_back (recording.count ());
+        }
+    }
+
+    std::ofstream file;
+    if ( !output_path.empty () )
+    {
+        file.open (output_path);
+        if ( !file.is_open () )
+        {
+            std::cerr << "Can't open \"" << output_path << "\" for writing" << std::endl;
+            return 1;
+        }
+    }
+    std::ostream &out = output_path.empty () ? std::cout : file;
+
+    if ( format == "json" )
+        out << "{\n  \"device\": \"" << capabilities.properties.deviceName.data () << "\", \"draws\": " << draw_count
+            << ",\n  \"modes\": [\n";
+    else
+        out << "mode,draws,runs,median_ms,min_ms,max_ms,ns_per_draw\n";
+
+    for ( std::size_t i = 0; i < modes.size (); ++i )
+    {
+        const vk_utils::sample_series &samples = modes[i].first;
+        double ns_per_draw                     = samples.median_ms () * 1e6 / draw_count;
+
+        if ( format == "json" )
+            out << "    {\"mode\": \"" << samples.name << "\", \"runs\": " << samples.count ()
+                << ", \"median_ms\": " << samples.median_ms () << ", \"min_ms\": " << samples.min_ms ()
+                << ", \"max_ms\": " << samples.max_ms () << ", \"ns_per_draw\": " << ns_per_draw << "}"
+                << (i + 1 < modes.size () ? "," : "") << '\n';
+        else
+            out << samples.name << ',' << draw_count << ',' << samples.count () << ',' << samples.median_ms () << ','
+                << samples.min_ms () << ',' << samples.max_ms () << ',' << ns_per_draw << '\n';
+    }
+
+    if ( format == "json" )
+        out << "  ]\n}\n";
+}
@@ -0,0 +1,659 @@
+#pragma once
+
+#include "logger.hpp"
+#include "memory.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <vulkan/vulkan_raii.hpp>
+
+namespace graphics
+{
+namespace vk_utils
+{
+
+// What a pass does with a resource, each one maps to stages, access flags and (for images) a layout
+enum class resource_usage
+{
+    color_attachment_write,
+    depth_attachment_write,
+    depth_attachment_read,
+    sampled_read,
+    storage_read,
+    storage_write,
+    transfer_read,
+    transfer_write,
+    vertex_buffer_read,
+    index_buffer_read,
+    indirect_read,
+    uniform_read,
+};
+
+struct usage_info
+{
+    vk::PipelineStageFlags2 stages;
+    vk::AccessFlags2 access;
+    vk::ImageLayout layout;
+    bool write;
+};
+
+inline usage_info describe (resource_usage usage)
+{
+    using stage  = vk::PipelineStageFlagBits2;
+    using access = vk::AccessFlagBits2;
+    using layout = vk::ImageLayout;
+
+    switch ( usage )
+    {
+    case resource_usage::color_attachment_write:
+        return {stage::eColorAttachmentOutput, access::eColorAttachmentRead | access::eColorAttachmentWrite,
+                layout::eColorAttachmentOptimal, true};
+    case resource_usage::depth_attachment_write:
+        return {stage::eEarlyFragmentTests | stage::eLateFragmentTests,
+                access::eDepthStencilAttachmentRead | access::eDepthStencilAttachmentWrite,
+                layout::eDepthStencilAttachmentOptimal, true};
+    case resource_usage::depth_attachment_read:
+        return {stage::eEarlyFragmentTests | stage::eLateFragmentTests, access::eDepthStencilAttachmentRead,
+                layout::eDepthStencilReadOnlyOptimal, false};
+    case resource_usage::sampled_read:
+        return {stage::eFragmentShader, access::eShaderSampledRead, layout::eShaderReadOnlyOptimal, false};
+    case resource_usage::storage_read:
+        return {stage::eComputeShader, access::eShaderStorageRead, layout::eGeneral, false};
+    case resource_usage::storage_write:
+        return {stage::eComputeShader, access::eShaderStorageRead | access::eShaderStorageWrite, layout::eGeneral,
+                true};
+    case resource_usage::transfer_read:
+        return {stage::eTransfer, access::eTransferRead, layout::eTransferSrcOptimal, false};
+    case resource_usage::transfer_write:
+        return {stage::eTransfer, access::eTransferWrite, layout::eTransferDstOptimal, true};
+    case resource_usage::vertex_buffer_read:
+        return {stage::eVertexAttributeInput, access::eVertexAttributeRead, layout::eUndefined, false};
+    case resource_usage::index_buffer_read:
+        return {stage::eIndexInput, access::eIndexRead, layout::eUndefined, false};
+    case resource_usage::indirect_read:
+        return {stage::eDrawIndirect, access::eIndirectCommandRead, layout::eUndefined, false};
+    case resource_usage::uniform_read:
+        return {stage::eVertexShader | stage::eFragmentShader | stage::eComputeShader, access::eUniformRead,
+                layout::eUndefined, false};
+    }
+    throw std::runtime_error ("Unknown resource usage!");
+}
+
+// Handles are indices into the graph that created them
+struct graph_image
+{
+    uint32_t index = UINT32_MAX;
+};
+
+struct graph_buffer
+{
+    uint32_t index = UINT32_MAX;
+};
+
+// Transient images are created, sized and (possibly) aliased by the graph itself
+struct image_description
+{
+    vk::Format format;
+    vk::Extent2D extent;
+    vk::ImageAspectFlags aspect = vk::ImageAspectFlagBits::eColor;
+};
+
+struct render_graph;
+
+// Returned by add_pass () to declare what the pass touches
+struct pass_builder
+{
+    render_graph &graph;
+    uint32_t pass;
+
+    inline pass_builder &read (graph_image image, resource_usage usage);
+    inline pass_builder &write (graph_image image, resource_usage usage);
+    inline pass_builder &read (graph_buffer buffer, resource_usage usage);
+    inline pass_builder &write (graph_buffer buffer, resource_usage usage);
+    // keeps the pass alive even when nothing reads what it writes, e.g. readbacks to the host
+    inline pass_builder &side_effects ();
+};
+
+/*
+ * Frame graph: passes are added in execution order and declare every image and buffer they read or write.
+ * compile () drops passes whose results nobody uses, creates the transient images of the remaining ones and
+ * lets transients with disjoint lifetimes share memory. execute () records the passes with synchronization2
+ * barriers and layout transitions derived from the declared usages, so passes never place barriers by hand.
+ *
+ * Imported resources (the swapchain image, long-lived buffers) are owned by someone else; their handles can
+ * change between frames through set_image ()/set_buffer (). A graph is compiled once and executed every
+ * frame; build a new one when the transients have to change size.
+ */
+struct render_graph
+{
+    using execute_function = std::function<void (vk::raii::CommandBuffer &, const render_graph &)>;
+
+    render_graph () {}
+    render_graph (const render_graph &)             = delete;
+    render_graph &operator= (const render_graph &) = delete;
+
+    ~render_graph ()
+    {
+        m_images.clear ();   // the transient images go before the memory they are bound to
+        for ( auto &slot : m_slots )
+            m_allocator->free (slot.memory);
+    }
+
+    graph_image import_image (const std::string &name, vk::ImageAspectFlags aspect, vk::ImageLayout initial_layout,
+                              vk::PipelineStageFlags2 initial_stages, vk::ImageLayout final_layout)
+    {
+        image_resource image;
+        image.name           = name;
+        image.imported       = true;
+        image.aspect         = aspect;
+        image.initial_layout = initial_layout;
+        image.initial_stages = initial_stages;
+        image.final_layout   = final_layout;
+        m_images.push_back (std::move (image));
+        return graph_image {static_cast<uint32_t> (m_images.size () - 1)};
+    }
+
+    graph_image create_image (const std::string &name, const image_description &description)
+    {
+        image_resource image;
+        image.name        = name;
+        image.description = description;
+        image.aspect      = description.aspect;
+        m_images.push_back (std::move (image));
+        return graph_image {static_cast<uint32_t> (m_images.size () - 1)};
+    }
+
+    graph_buffer import_buffer (const std::string &name, vk::Buffer buffer = nullptr)
+    {
+        m_buffers.push_back (buffer_resource {name, buffer});
+        return graph_buffer {static_cast<uint32_t> (m_buffers.size () - 1)};
+    }
+
+    void set_image (graph_image image, vk::Image handle, vk::ImageView view)
+    {
+        m_images.at (image.index).image = handle;
+        m_images.at (image.index).view  = view;
+    }
+
+    void set_buffer (graph_buffer buffer, vk::Buffer handle) { m_buffers.at (buffer.index).buffer = handle; }
+
+    vk::Image image (graph_image image) const { return m_images.at (image.index).image; }
+    vk::ImageView view (graph_image image) const { return m_images.at (image.index).view; }
+    vk::Buffer buffer (graph_buffer buffer) const { return m_buffers.at (buffer.index).buffer; }
+
+    pass_builder add_pass (const std::string &name, execute_function execute)
+    {
+        pass_node pass;
+        pass.name    = name;
+        pass.execute = std::move (execute);
+        m_passes.push_back (std::move (pass));
+        return pass_builder {*this, static_cast<uint32_t> (m_passes.size () - 1)};
+    }
+
+    void compile (vk::raii::Device &device, device_allocator &allocator)
+    {
+        m_allocator = &allocator;
+        cull ();
+        create_transients (device, allocator);
+        m_compiled = true;
+    }
+
+    void execute (vk::raii::CommandBuffer &command_buffer)
+    {
+        if ( !m_compiled )
+            throw std::runtime_error ("Render graph executed before it was compiled!");
+
+        std::vector<resource_state> image_states (m_images.size ()), buffer_states (m_buffers.size ());
+        for ( uint32_t i = 0; i < m_images.size (); ++i )
+            image_states[i] = initial_state (m_images[i]);
+
+        std::vector<vk::ImageMemoryBarrier2> image_barriers;
+        std::vector<vk::BufferMemoryBarrier2> buffer_barriers;
+
+        for ( auto &pass : m_passes )
+        {
+            if ( pass.culled )
+                continue;
+
+            image_barriers.clear ();
+            buffer_barriers.clear ();
+
+            for ( auto &access : pass.images )
+            {
+                vk::ImageMemoryBarrier2 barrier {};
+                if ( transition (image_states[access.resource], describe (access.usage), true, barrier) )
+                    image_barriers.push_back (image_barrier (m_images[access.resource], barrier));
+            }
+            for ( auto &access : pass.buffers )
+            {
+                vk::ImageMemoryBarrier2 barrier {};
+                if ( transition (buffer_states[access.resource], describe (access.usage), false, barrier) )
+                    buffer_barriers.push_back (buffer_barrier (m_buffers[access.resource], barrier));
+            }
+
+            emit (command_buffer, image_barriers, buffer_barriers);
+            pass.execute (command_buffer, *this);
+        }
+
+        // hand the imported images back in the layout their owner expects, e.g. PRESENT_SRC for the swapchain
+        image_barriers.clear ();
+        buffer_barriers.clear ();
+        for ( uint32_t i = 0; i < m_images.size (); ++i )
+        {
+            resource_state &state = image_states[i];
+            if ( !m_images[i].imported || m_images[i].final_layout == vk::ImageLayout::eUndefined ||
+                 state.layout == m_images[i].final_layout )
+                continue;
+
+            vk::ImageMemoryBarrier2 barrier {};
+            barrier.srcStageMask  = state.write_stages | state.read_stages;
+            barrier.srcAccessMask = state.write_access;
+            barrier.dstStageMask  = vk::PipelineStageFlagBits2::eNone;
+            barrier.dstAccessMask = vk::AccessFlagBits2::eNone;
+            barrier.oldLayout     = state.layout;
+            barrier.newLayout     = m_images[i].final_layout;
+            image_barriers.push_back (image_barrier (m_images[i], barrier));
+        }
+        emit (command_buffer, image_barriers, buffer_barriers);
+    }
+
+    void report (std::ostream &os) const
+    {
+        uint32_t culled = static_cast<uint32_t> (
+            std::count_if (m_passes.begin (), m_passes.end (), [] (const pass_node &pass) { return pass.culled; }));
+        os << "Render graph: " << m_passes.size () - culled << " pass(es), " << culled << " culled" << std::endl;
+
+        vk::DeviceSize aliased = 0;
+        for ( auto &slot : m_slots )
+            aliased += slot.requirements.size;
+        if ( m_transient_bytes )
+            os << "Render graph: " << m_transient_bytes << " bytes of transient images in " << aliased
+               << " bytes of memory" << std::endl;
+    }
+
+  private:
+    friend struct pass_builder;
+
+    struct resource_access
+    {
+        uint32_t resource;
+        resource_usage usage;
+    };
+
+    struct pass_node
+    {
+        std::string name;
+        execute_function execute;
+        std::vector<resource_access> images;
+        std::vector<resource_access> buffers;
+        bool side_effects = false;
+        bool culled       = false;
+    };
+
+    struct image_resource
+    {
+        std::string name;
+        bool imported = false;
+        vk::ImageAspectFlags aspect;
+        vk::Image image;
+        vk::ImageView view;
+
+        // imported images only
+        vk::ImageLayout initial_layout = vk::ImageLayout::eUndefined;
+        vk::PipelineStageFlags2 initial_stages;
+        vk::ImageLayout final_layout = vk::ImageLayout::eUndefined;
+
+        // transient images only
+        image_description description {};
+        vk::raii::Image transient_image {nullptr};
+        vk::raii::ImageView transient_view {nullptr};
+        uint32_t first_pass = UINT32_MAX, last_pass = 0;
+        uint32_t slot       = UINT32_MAX;
+    };
+
+    struct buffer_resource
+    {
+        std::string name;
+        vk::Buffer buffer;
+    };
+
+    // transients whose lifetimes don't overlap share one of these
+    struct memory_slot
+    {
+        vk::MemoryRequirements requirements;
+        std::vector<std::pair<uint32_t, uint32_t>> lifetimes;
+        vk::PipelineStageFlags2 stages;
+        vk::AccessFlags2 write_access;
+        allocation memory;
+    };
+
+    // What the last accesses to a resource were, all tracked within one execute ()
+    struct resource_state
+    {
+        vk::ImageLayout layout = vk::ImageLayout::eUndefined;
+        vk::PipelineStageFlags2 write_stages;
+        vk::AccessFlags2 write_access;
+        vk::PipelineStageFlags2 read_stages;      // reads since the last write, a later write has to wait for them
+        vk::PipelineStageFlags2 visible_stages;   // stages that already see the last write
+    };
+
+    static constexpr vk::AccessFlags2 write_bits =
+        vk::AccessFlagBits2::eColorAttachmentWrite | vk::AccessFlagBits2::eDepthStencilAttachmentWrite |
+        vk::AccessFlagBits2::eShaderStorageWrite | vk::AccessFlagBits2::eShaderWrite |
+        vk::AccessFlagBits2::eTransferWrite | vk::AccessFlagBits2::eHostWrite | vk::AccessFlagBits2::eMemoryWrite;
+
+    std::vector<pass_node> m_passes;
+    std::vector<image_resource> m_images;
+    std::vector<buffer_resource> m_buffers;
+    std::vector<memory_slot> m_slots;
+    device_allocator *m_allocator    = nullptr;
+    vk::DeviceSize m_transient_bytes = 0;
+    bool m_compiled                  = false;
+
+    /*
+     * Walks the passes backwards: a pass survives when it has side effects or writes something that is imported
+     * or read by a pass that survived. Its reads then become needed in turn.
+     */
+    void cull ()
+    {
+        std::vector<bool> image_needed (m_images.size ()), buffer_needed (m_buffers.size (), true);
+        for ( uint32_t i = 0; i < m_images.size (); ++i )
+            image_needed[i] = m_images[i].imported;
+
+        for ( auto pass = m_passes.rbegin (); pass != m_passes.rend (); ++pass )
+        {
+            bool needed = pass->side_effects;
+            for ( auto &access : pass->images )
+                needed = needed || (describe (access.usage).write && image_needed[access.resource]);
+            for ( auto &access : pass->buffers )
+                needed = needed || (describe (access.usage).write && buffer_needed[access.resource]);
+
+            pass->culled = !needed;
+            if ( pass->culled )
+            {
+                GRAPHICS_LOG_DEBUG ("Render graph: culled pass \"" << pass->name << "\"");
+                continue;
+            }
+
+            for ( auto &access : pass->images )
+                image_needed[access.resource] = true;
+        }
+    }
+
+    void create_transients (vk::raii::Device &device, device_allocator &allocator)
+    {
+        // lifetimes and usage flags come from the passes that survived culling
+        std::vector<vk::ImageUsageFlags> usages (m_images.size ());
+        std::vector<vk::PipelineStageFlags2> stages (m_images.size ());
+        std::vector<vk::AccessFlags2> writes (m_images.size ());
+        for ( uint32_t p = 0; p < m_passes.size (); ++p )
+        {
+            if ( m_passes[p].culled )
+                continue;
+            for ( auto &access : m_passes[p].images )
+            {
+                image_resource &image = m_images[access.resource];
+                image.first_pass      = std::min (image.first_pass, p);
+                image.last_pass       = std::max (image.last_pass, p);
+                usages[access.resource] |= image_usage (access.usage);
+
+                usage_info info = describe (access.usage);
+                stages[access.resource] |= info.stages;
+                writes[access.resource] |= info.access & write_bits;
+            }
+        }
+
+        std::vector<uint32_t> transients;
+        for ( uint32_t i = 0; i < m_images.size (); ++i )
+        {
+            image_resource &image = m_images[i];
+            if ( image.imported || image.first_pass == UINT32_MAX )
+                continue;
+
+            vk::Extent2D extent = image.description.extent;
+
+            vk::ImageCreateInfo image_info {};
+            image_info.imageType     = vk::ImageType::e2D;
+            image_info.format        = image.description.format;
+            image_info.extent        = vk::Extent3D {extent.width, extent.height, 1};
+            image_info.mipLevels     = 1;
+            image_info.arrayLayers   = 1;
+            image_info.samples       = vk::SampleCountFlagBits::e1;
+            image_info.tiling        = vk::ImageTiling::eOptimal;
+            image_info.usage         = usages[i];
+            image_info.sharingMode   = vk::SharingMode::eExclusive;
+            image_info.initialLayout = vk::ImageLayout::eUndefined;
+            image.transient_image    = device.createImage (image_info);
+            transients.push_back (i);
+        }
+
+        // biggest first, each one goes into the first slot it fits in without overlapping anybody's lifetime
+        std::sort (transients.begin (), transients.end (), [this] (uint32_t a, uint32_t b) {
+            return m_images[a].transient_image.getMemoryRequirements ().size >
+                   m_images[b].transient_image.getMemoryRequirements ().size;
+        });
+
+        for ( uint32_t i : transients )
+        {
+            image_resource &image               = m_images[i];
+            vk::MemoryRequirements requirements = image.transient_image.getMemoryRequirements ();
+            m_transient_bytes += requirements.size;
+
+            auto fits = [&image, &requirements] (const memory_slot &slot) {
+                if ( !(slot.requirements.memoryTypeBits & requirements.memoryTypeBits) )
+                    return false;
+                return std::none_of (slot.lifetimes.begin (), slot.lifetimes.end (), [&image] (const auto &lifetime) {
+                    return image.first_pass <= lifetime.second && lifetime.first <= image.last_pass;
+                });
+            };
+
+            auto found = std::find_if (m_slots.begin (), m_slots.end (), fits);
+            if ( found == m_slots.end () )
+            {
+                m_slots.push_back (memory_slot {requirements, {}, {}, {}, {}});
+                found = std::prev (m_slots.end ());
+            }
+
+            found->requirements.size      = std::max (found->requirements.size, requirements.size);
+            found->requirements.alignment = std::max (found->requirements.alignment, requirements.alignment);
+            found->requirements.memoryTypeBits &= requirements.memoryTypeBits;
+            found->lifetimes.emplace_back (image.first_pass, image.last_pass);
+            found->stages |= stages[i];
+            found->write_access |= writes[i];
+            image.slot = static_cast<uint32_t> (found - m_slots.begin ());
+        }
+
+        for ( auto &slot : m_slots )
+            slot.memory = allocator.allocate (slot.requirements, vk::MemoryPropertyFlagBits::eDeviceLocal, {},
+                                              resource_kind::optimal);
+
+        for ( uint32_t i : transients )
+        {
+            image_resource &image = m_images[i];
+            image.transient_image.bindMemory (m_slots[image.slot].memory.memory, m_slots[image.slot].memory.offset);
+
+            vk::ImageViewCreateInfo view_info {};
+            view_info.image            = *image.transient_image;
+            view_info.viewType         = vk::ImageViewType::e2D;
+            view_info.format           = image.description.format;
+            view_info.subresourceRange = vk::ImageSubresourceRange {image.aspect, 0, 1, 0, 1};
+            image.transient_view       = device.createImageView (view_info);
+
+            image.image = *image.transient_image;
+            image.view  = *image.transient_view;
+        }
+    }
+
+    static vk::ImageUsageFlags image_usage (resource_usage usage)
+    {
+        switch ( usage )
+        {
+        case resource_usage::color_attachment_write:
+            return vk::ImageUsageFlagBits::eColorAttachment;
+        case resource_usage::depth_attachment_write:
+        case resource_usage::depth_attachment_read:
+            return vk::ImageUsageFlagBits::eDepthStencilAttachment;
+        case resource_usage::sampled_read:
+            return vk::ImageUsageFlagBits::eSampled;
+        case resource_usage::storage_read:
+        case resource_usage::storage_write:
+            return vk::ImageUsageFlagBits::eStorage;
+        case resource_usage::transfer_read:
+            return vk::ImageUsageFlagBits::eTransferSrc;
+        case resource_usage::transfer_write:
+            return vk::ImageUsageFlagBits::eTransferDst;
+        default:
+            return {};
+        }
+    }
+
+    /*
+     * Transients start every frame with undefined contents. Whatever shared their memory last, in this frame
+     * or in the one before on the same queue, has to be done with it, so the first barrier waits for every
+     * stage the memory slot is used in.
+     */
+    resource_state initial_state (const image_resource &image) const
+    {
+        resource_state state;
+        if ( image.imported )
+        {
+            state.layout       = image.initial_layout;
+            state.write_stages = image.initial_stages;
+        }
+        else if ( image.slot != UINT32_MAX )
+        {
+            state.write_stages = m_slots[image.slot].stages;
+            state.write_access = m_slots[image.slot].write_access;
+        }
+        return state;
+    }
+
+    // Updates the state for one access and fills in the stage/access/layout part of a barrier when one is needed
+    static bool transition (resource_state &state, const usage_info &usage, bool is_image,
+                            vk::ImageMemoryBarrier2 &barrier)
+    {
+        bool layout_change = is_image && state.layout != usage.layout;
+
+        if ( usage.write || layout_change )
+        {
+            barrier.srcStageMask  = state.write_stages | state.read_stages;
+            barrier.srcAccessMask = state.write_access;
+            barrier.dstStageMask  = usage.stages;
+            barrier.dstAccessMask = usage.access;
+            barrier.oldLayout     = state.layout;
+            barrier.newLayout     = usage.layout;
+
+            // a layout transition is a write of its own that the following reads are ordered after
+            state.layout         = usage.layout;
+            state.write_stages   = usage.stages;
+            state.write_access   = usage.write ? usage.access & write_bits : vk::AccessFlags2 {};
+            state.read_stages    = usage.write ? vk::PipelineStageFlags2 {} : usage.stages;
+            state.visible_stages = usage.stages;
+            return layout_change || barrier.srcStageMask;
+        }
+
+        state.read_stages |= usage.stages;
+        if ( !state.write_access || !(usage.stages & ~state.visible_stages) )
+            return false;
+
+        // read after write from a stage that doesn't see the write yet
+        barrier.srcStageMask  = state.write_stages;
+        barrier.srcAccessMask = state.write_access;
+        barrier.dstStageMask  = usage.stages;
+        barrier.dstAccessMask = usage.access;
+        barrier.oldLayout     = state.layout;
+        barrier.newLayout     = state.layout;
+        state.visible_stages |= usage.stages;
+        return true;
+    }
+
+    static vk::ImageMemoryBarrier2 image_barrier (const image_resource &image, vk::ImageMemoryBarrier2 barrier)
+    {
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.image               = image.image;
+        barrier.subresourceRange    = vk::ImageSubresourceRange {image.aspect, 0, VK_REMAINING_MIP_LEVELS, 0,
+                                                                 VK_REMAINING_ARRAY_LAYERS};
+        return barrier;
+    }
+
+    static vk::BufferMemoryBarrier2 buffer_barrier (const buffer_resource &buffer,
+                                                    const vk::ImageMemoryBarrier2 &template_barrier)
+    {
+        vk::BufferMemoryBarrier2 barrier {};
+        barrier.srcStageMask        = template_barrier.srcStageMask;
+        barrier.srcAccessMask       = template_barrier.srcAccessMask;
+        barrier.dstStageMask        = template_barrier.dstStageMask;
+        barrier.dstAccessMask       = template_barrier.dstAccessMask;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.buffer              = buffer.buffer;
+        barrier.offset              = 0;
+        barrier.size                = VK_WHOLE_SIZE;
+        return barrier;
+    }
+
+    static void emit (vk::raii::CommandBuffer &command_buffer, const std::vector<vk::ImageMemoryBarrier2> &images,
+                      const std::vector<vk::BufferMemoryBarrier2> &buffers)
+    {
+        if ( images.empty () && buffers.empty () )
+            return;
+
+        // all barriers of a pass go out in one call so the driver can batch the transitions
+        vk::DependencyInfo dependency_info {};
+        dependency_info.imageMemoryBarrierCount  = static_cast<uint32_t> (images.size ());
+        dependency_info.pImageMemoryBarriers     = images.data ();
+        dependency_info.bufferMemoryBarrierCount = static_cast<uint32_t> (buffers.size ());
+        dependency_info.pBufferMemoryBarriers    = buffers.data ();
+        command_buffer.pipelineBarrier2 (dependency_info);
+    }
+};
+
+inline pass_builder &pass_builder::read (graph_image image, resource_usage usage)
+{
+    if ( describe (usage).write )
+        throw std::runtime_error ("Render graph: a read was declared with a writing usage!");
+    graph.m_passes[pass].images.push_back (render_graph::resource_access {image.index, usage});
+    return *this;
+}
+
+inline pass_builder &pass_builder::write (graph_image image, resource_usage usage)
+{
+    if ( !describe (usage).write )
+        throw std::runtime_error ("Render graph: a write was declared with a reading usage!");
+    graph.m_passes[pass].images.push_back (render_graph::resource_access {image.index, usage});
+    return *this;
+}
+
+inline pass_builder &pass_builder::read (graph_buffer buffer, resource_usage usage)
+{
+    if ( describe (usage).write )
+        throw std::runtime_error ("Render graph: a read was declared with a writing usage!");
+    graph.m_passes[pass].buffers.push_back (render_graph::resource_access {buffer.index, usage});
+    return *this;
+}
+
+inline pass_builder &pass_builder::write (graph_buffer buffer, resource_usage usage)
+{
+    if ( !describe (usage).write )
+        throw std::runtime_error ("Render graph: a write was declared with a reading usage!");
+    graph.m_passes[pass].buffers.push_back (render_graph::resource_access {buffer.index, usage});
+    return *this;
+}
+
+inline pass_builder &pass_builder::side_effects ()
+{
+    graph.m_passes[pass].side_effects = true;
+    return *this;
+}
+
+}   // namespace vk_utils
+}   // namespace graphics
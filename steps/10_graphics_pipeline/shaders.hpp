@@ -1,11 +1,22 @@
 #pragma once
 
-#include <cassert>
-#include <fstream>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
 #include <string>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include <vulkan/vulkan_raii.hpp>
 
 namespace graphics
@@ -13,33 +24,186 @@ namespace graphics
 namespace vk_utils
 {
 
-std::vector<char> read_file (std::string filename)
+constexpr uint32_t spirv_magic = 0x07230203;
+
+// Non-owning view of SPIR-V words, whatever they live in
+struct spirv_code
+{
+    const uint32_t *words  = nullptr;
+    std::size_t word_count = 0;
+
+    std::size_t size_bytes () const { return word_count * sizeof (uint32_t); }
+};
+
+/*
+ * Read-only mapping of a SPIR-V file. Mappings start on a page boundary, so unlike a std::vector<char>
+ * the words can be handed to the driver as uint32_t without any alignment tricks or copies.
+ */
+struct mapped_file
 {
+    mapped_file () {}
+    mapped_file (const std::string &filename)
+    {
+        int fd = ::open (filename.c_str (), O_RDONLY | O_CLOEXEC);
+        if ( fd < 0 )
+            throw std::runtime_error ("Failed to open \"" + filename + "\": " + std::strerror (errno));
+
+        struct stat file_stat;
+        if ( ::fstat (fd, &file_stat) < 0 )
+        {
+            int error = errno;
+            ::close (fd);
+            throw std::runtime_error ("Failed to stat \"" + filename + "\": " + std::strerror (error));
+        }
+
+        m_size = static_cast<std::size_t> (file_stat.st_size);
+        if ( !m_size )
+        {
+            ::close (fd);
+            throw std::runtime_error ("\"" + filename + "\" is empty");
+        }
+
+        void *data = ::mmap (nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        int error  = errno;
+        ::close (fd);   // the mapping keeps the file alive on its own
+
+        if ( data == MAP_FAILED )
+            throw std::runtime_error ("Failed to map \"" + filename + "\": " + std::strerror (error));
+
+        m_data = data;
+    }
 
-    std::ifstream file (filename, std::ios::ate | std::ios::binary);
+    mapped_file (mapped_file &&other) noexcept
+        : m_data {std::exchange (other.m_data, nullptr)}, m_size {std::exchange (other.m_size, 0)}
+    {}
+    mapped_file &operator= (mapped_file &&other) noexcept
+    {
+        std::swap (m_data, other.m_data);
+        std::swap (m_size, other.m_size);
+        return *this;
+    }
+    mapped_file (const mapped_file &)             = delete;
+    mapped_file &operator= (const mapped_file &) = delete;
 
-    assert (file.is_open ());
-    assert (file.tellg () > 0);
+    ~mapped_file ()
+    {
+        if ( m_data )
+            ::munmap (m_data, m_size);
+    }
 
-    std::size_t filesize {static_cast<std::size_t> (file.tellg ())};
+    const void *data () const { return m_data; }
+    std::size_t size () const { return m_size; }
 
-    std::vector<char> buffer (filesize);
-    file.seekg (0);
-    file.read (buffer.data (), filesize);
+  private:
+    void *m_data       = nullptr;
+    std::size_t m_size = 0;
+};
 
-    file.close ();
-    return buffer;
+// SPIR-V embedded into the binary at build time, see embed_shader () in CMakeLists.txt
+template <std::size_t N> constexpr spirv_code as_spirv (const uint32_t (&words)[N]) { return spirv_code {words, N}; }
+
+inline spirv_code as_spirv (const mapped_file &file, const std::string &filename)
+{
+    if ( file.size () % sizeof (uint32_t) )
+        throw std::runtime_error ("\"" + filename + "\" is not SPIR-V: size is not a multiple of 4");
+
+    spirv_code code {static_cast<const uint32_t *> (file.data ()), file.size () / sizeof (uint32_t)};
+    if ( code.words[0] != spirv_magic )
+        throw std::runtime_error ("\"" + filename + "\" is not SPIR-V: bad magic number");
+
+    return code;
 }
 
-vk::raii::ShaderModule create_module (const std::string &filename, vk::raii::Device &device)
+// FNV-1a over the words, good enough to tell shader binaries apart
+inline uint64_t hash_code (spirv_code code)
+{
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for ( std::size_t i = 0; i < code.word_count; ++i )
+    {
+        hash ^= code.words[i];
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+vk::raii::ShaderModule create_module (spirv_code code, vk::raii::Device &device)
 {
-    auto source_code = read_file (filename);
     vk::ShaderModuleCreateInfo module_info {};
     module_info.flags    = vk::ShaderModuleCreateFlags {};
-    module_info.codeSize = source_code.size ();
-    module_info.pCode    = reinterpret_cast<uint32_t *> (source_code.data ());
+    module_info.codeSize = code.size_bytes ();
+    module_info.pCode    = code.words;
     return device.createShaderModule (module_info);
 }
 
+vk::raii::ShaderModule create_module (const std::string &filename, vk::raii::Device &device)
+{
+    mapped_file file {filename};
+    return create_module (as_spirv (file, filename), device);
+}
+
+template <std::size_t N> vk::raii::ShaderModule create_module (const uint32_t (&words)[N], vk::raii::Device &device)
+{
+    return create_module (as_spirv (words), device);
+}
+
+/*
+ * Shader modules keyed by the hash of their contents: the same binary used by several pipelines
+ * becomes a single module which is created once, no matter which path it was loaded from.
+ * Every entry keeps a copy of its words, a hash match only counts once they compare equal.
+ * Pipelines may be built on worker threads, so lookups are serialized.
+ */
+struct shader_module_cache
+{
+    vk::ShaderModule get (vk::raii::Device &device, spirv_code code)
+    {
+        uint64_t hash = hash_code (code);
+
+        std::lock_guard<std::mutex> lock {m_mutex};
+
+        auto candidates = m_modules.equal_range (hash);
+        for ( auto it = candidates.first; it != candidates.second; ++it )
+            if ( it->second.words.size () == code.word_count &&
+                 !std::memcmp (it->second.words.data (), code.words, code.size_bytes ()) )
+                return *it->second.module;
+
+        entry cached {std::vector<uint32_t> (code.words, code.words + code.word_count), create_module (code, device)};
+        auto inserted = m_modules.emplace (hash, std::move (cached));
+        return *inserted->second.module;
+    }
+
+    vk::ShaderModule get (vk::raii::Device &device, const std::string &filename)
+    {
+        mapped_file file {filename};
+        return get (device, as_spirv (file, filename));
+    }
+
+    std::size_t size () const
+    {
+        std::lock_guard<std::mutex> lock {m_mutex};
+        return m_modules.size ();
+    }
+
+  private:
+    struct entry
+    {
+        std::vector<uint32_t> words;
+        vk::raii::ShaderModule module;
+    };
+
+    mutable std::mutex m_mutex;
+    std::unordered_multimap<uint64_t, entry> m_modules;
+};
+
+// Returns a module from the cache when there is one, otherwise creates it into the storage provided by the caller
+inline vk::ShaderModule load_shader_module (vk::raii::Device &device, shader_module_cache *cache, spirv_code code,
+                                            vk::raii::ShaderModule &storage)
+{
+    if ( cache )
+        return cache->get (device, code);
+
+    storage = create_module (code, device);
+    return *storage;
+}
+
 }   // namespace vk_utils
-}   // namespace graphics
\ No newline at end of file
+}   // namespace graphics
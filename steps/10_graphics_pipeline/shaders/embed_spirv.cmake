@@ -0,0 +1,23 @@
+# Wraps the word list printed by glslc -mfmt=num / glslangValidator -x into a header
+# usage: cmake -DINPUT=<words> -DOUTPUT=<header> -DNAME=<array name> -P embed_spirv.cmake
+
+file (READ ${INPUT} words)
+string (STRIP "${words}" words)
+
+file (WRITE ${OUTPUT}
+"#pragma once
+
+#include <cstdint>
+
+namespace graphics
+{
+namespace shaders
+{
+
+inline constexpr uint32_t ${NAME}[] = {
+${words}
+};
+
+}   // namespace shaders
+}   // namespace graphics
+")
@@ -1,21 +1,18 @@
 #version 450
 
-vec2 positions [3] = vec2[](
-    vec2(0.0, -0.5),
-    vec2(0.5, 0.5),
-    vec2(-0.5, 0.5)
-);
+layout(location = 0) in vec2 position;
+layout(location = 1) in vec3 color;
 
-vec3 colors[3] = vec3[](
-    vec3(1.0, 0.0, 0.0),
-    vec3(0.0, 1.0, 0.0),
-    vec3(0.0, 0.0, 1.0)
-);
+layout(push_constant) uniform draw_constants
+{
+    vec2 offset;
+    float scale;
+} draw;
 
 layout(location = 0) out vec3 frag_color;
 
 void main()
 {
-    gl_Position = vec4(positions[gl_VertexIndex], 0.0, 1.0);
-    frag_color = colors[gl_VertexIndex];
-}
\ No newline at end of file
+    gl_Position = vec4(position * draw.scale + draw.offset, 0.0, 1.0);
+    frag_color = color;
+}
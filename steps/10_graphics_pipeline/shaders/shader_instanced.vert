@@ -0,0 +1,16 @@
+#version 450
+
+layout(location = 0) in vec2 position;
+layout(location = 1) in vec3 color;
+
+// one vk_utils::instance_data per object, the culling shader points firstInstance at it
+layout(location = 2) in vec2 instance_offset;
+layout(location = 3) in float instance_scale;
+
+layout(location = 0) out vec3 frag_color;
+
+void main()
+{
+    gl_Position = vec4(position * instance_scale + instance_offset, 0.0, 1.0);
+    frag_color = color;
+}
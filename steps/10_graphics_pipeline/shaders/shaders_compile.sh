@@ -1,2 +0,0 @@
-glslc shader.vert -o vertex.spv
-glslc shader.frag -o fragment.spv
\ No newline at end of file
@@ -0,0 +1,219 @@
+#pragma once
+
+#include "memory.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <vulkan/vulkan_raii.hpp>
+
+namespace graphics
+{
+namespace vk_utils
+{
+
+/*
+ * One persistently mapped host-visible buffer cut into a region per frame in flight. Uploads are copied
+ * into the region of the current frame and the transfer commands are batched into the frame's upload
+ * command buffer. A region is only rewound in begin_frame (), which the engine calls after waiting for the
+ * frame's previous submission, so the GPU is guaranteed to be done reading the data written there last time.
+ *
+ * Uploads are accepted before the first frame and between begin_frame () and end_frame (). Anything
+ * queued later would be recorded by the next frame while living in the region of this one, which waiting
+ * for the next frame doesn't protect.
+ */
+struct staging_ring
+{
+    staging_ring (device_allocator &allocator, uint32_t frames_in_flight, vk::DeviceSize region_size,
+                  vk::DeviceSize copy_alignment = 16)
+        : m_allocator {&allocator}
+    {
+        // copyBufferToImage wants a source offset aligned to the texel size, 16 covers every format we use
+        m_alignment   = std::max<vk::DeviceSize> (copy_alignment, 16);
+        m_region_size = align_up (region_size, m_alignment);
+
+        vk::BufferCreateInfo buffer_info {};
+        buffer_info.size        = m_region_size * frames_in_flight;
+        buffer_info.usage       = vk::BufferUsageFlagBits::eTransferSrc;
+        buffer_info.sharingMode = vk::SharingMode::eExclusive;
+
+        m_buffer = allocator.create_buffer (buffer_info, vk::MemoryPropertyFlagBits::eHostVisible,
+                                            vk::MemoryPropertyFlagBits::eHostCoherent);
+        if ( !m_buffer.mapped () )
+            throw std::runtime_error ("Failed to map the staging buffer!");
+    }
+
+    staging_ring (const staging_ring &)             = delete;
+    staging_ring &operator= (const staging_ring &) = delete;
+
+    // Must only be called once the previous submission of frame_index has completed
+    void begin_frame (uint32_t frame_index)
+    {
+        // copies queued before the first frame still live in the region they were written to
+        if ( m_buffer_copies.empty () && m_image_copies.empty () )
+        {
+            m_region = frame_index;
+            m_head   = 0;
+        }
+        m_open = true;
+    }
+
+    void end_frame () { m_open = false; }
+
+    bool pending () const { return !m_buffer_copies.empty () || !m_image_copies.empty (); }
+
+    void upload_buffer (const void *data, vk::DeviceSize size, vk::Buffer destination, vk::DeviceSize offset = 0)
+    {
+        vk::BufferCopy region {};
+        region.srcOffset = write (data, size);
+        region.dstOffset = offset;
+        region.size      = size;
+
+        // one vkCmdCopyBuffer per destination, however many uploads went into it
+        auto found = std::find_if (m_buffer_copies.begin (), m_buffer_copies.end (),
+                                   [destination] (const buffer_copy &copy) { return copy.destination == destination; });
+        if ( found == m_buffer_copies.end () )
+            found = m_buffer_copies.insert (m_buffer_copies.end (), buffer_copy {destination, {}});
+        found->regions.push_back (region);
+    }
+
+    /*
+     * Replaces the contents of one subresource, the image is transitioned from UNDEFINED to TRANSFER_DST and
+     * then to final_layout
+     */
+    void upload_image (const void *data, vk::DeviceSize size, vk::Image destination, vk::Extent3D extent,
+                       vk::ImageSubresourceLayers subresource = {vk::ImageAspectFlagBits::eColor, 0, 0, 1},
+                       vk::ImageLayout final_layout = vk::ImageLayout::eShaderReadOnlyOptimal)
+    {
+        vk::BufferImageCopy region {};
+        region.bufferOffset      = write (data, size);
+        region.bufferRowLength   = 0;   // tightly packed
+        region.bufferImageHeight = 0;
+        region.imageSubresource  = subresource;
+        region.imageOffset       = vk::Offset3D {0, 0, 0};
+        region.imageExtent       = extent;
+
+        m_image_copies.push_back (image_copy {destination, region, final_layout});
+    }
+
+    // Records every queued copy followed by the barriers that make the data visible to the draws after it
+    void record (vk::raii::CommandBuffer &command_buffer)
+    {
+        if ( !pending () )
+            return;
+
+        m_allocator->flush (m_buffer.memory (), m_region * m_region_size, m_head);
+
+        std::vector<vk::ImageMemoryBarrier> to_transfer, to_final;
+        for ( auto &copy : m_image_copies )
+        {
+            to_transfer.push_back (layout_barrier (copy, vk::ImageLayout::eUndefined,
+                                                   vk::ImageLayout::eTransferDstOptimal, {},
+                                                   vk::AccessFlagBits::eTransferWrite));
+            to_final.push_back (layout_barrier (copy, vk::ImageLayout::eTransferDstOptimal, copy.final_layout,
+                                                vk::AccessFlagBits::eTransferWrite, vk::AccessFlagBits::eShaderRead));
+        }
+
+        if ( !to_transfer.empty () )
+            command_buffer.pipelineBarrier (vk::PipelineStageFlagBits::eTopOfPipe,
+                                            vk::PipelineStageFlagBits::eTransfer, {}, nullptr, nullptr, to_transfer);
+
+        for ( auto &copy : m_buffer_copies )
+            command_buffer.copyBuffer (**m_buffer, copy.destination, copy.regions);
+        for ( auto &copy : m_image_copies )
+            command_buffer.copyBufferToImage (**m_buffer, copy.destination, vk::ImageLayout::eTransferDstOptimal,
+                                              copy.region);
+
+        vk::MemoryBarrier uploaded {};
+        uploaded.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+        uploaded.dstAccessMask = vk::AccessFlagBits::eVertexAttributeRead | vk::AccessFlagBits::eIndexRead |
+                                 vk::AccessFlagBits::eUniformRead | vk::AccessFlagBits::eShaderRead |
+                                 vk::AccessFlagBits::eIndirectCommandRead;
+
+        vk::PipelineStageFlags consumers =
+            vk::PipelineStageFlagBits::eDrawIndirect | vk::PipelineStageFlagBits::eVertexInput |
+            vk::PipelineStageFlagBits::eVertexShader | vk::PipelineStageFlagBits::eFragmentShader |
+            vk::PipelineStageFlagBits::eComputeShader;
+        command_buffer.pipelineBarrier (vk::PipelineStageFlagBits::eTransfer, consumers, {}, uploaded, nullptr,
+                                        to_final);
+
+        m_buffer_copies.clear ();
+        m_image_copies.clear ();
+    }
+
+    vk::DeviceSize region_size () const { return m_region_size; }
+    vk::DeviceSize used () const { return m_head; }
+
+  private:
+    struct buffer_copy
+    {
+        vk::Buffer destination;
+        std::vector<vk::BufferCopy> regions;
+    };
+
+    struct image_copy
+    {
+        vk::Image destination;
+        vk::BufferImageCopy region;
+        vk::ImageLayout final_layout;
+    };
+
+    device_allocator *m_allocator = nullptr;
+    allocated_buffer m_buffer;
+    vk::DeviceSize m_region_size = 0;
+    vk::DeviceSize m_alignment   = 16;
+    uint32_t m_region            = 0;
+    vk::DeviceSize m_head        = 0;   // relative to the start of the current region
+    bool m_open                  = true;
+
+    std::vector<buffer_copy> m_buffer_copies;
+    std::vector<image_copy> m_image_copies;
+
+    static vk::DeviceSize align_up (vk::DeviceSize value, vk::DeviceSize alignment)
+    {
+        return (value + alignment - 1) / alignment * alignment;
+    }
+
+    // Copies data into the current region and returns its offset in the staging buffer
+    vk::DeviceSize write (const void *data, vk::DeviceSize size)
+    {
+        if ( !m_open )
+            throw std::runtime_error ("Staging uploads must be queued between begin_frame () and end_frame ()!");
+
+        vk::DeviceSize offset = align_up (m_head, m_alignment);
+        if ( offset + size > m_region_size )
+            throw std::runtime_error ("Staging region of " + std::to_string (m_region_size) +
+                                      " bytes is too small for an upload of " + std::to_string (size) + " bytes!");
+
+        vk::DeviceSize buffer_offset = m_region * m_region_size + offset;
+        std::memcpy (static_cast<char *> (m_buffer.mapped ()) + buffer_offset, data, size);
+        m_head = offset + size;
+        return buffer_offset;
+    }
+
+    static vk::ImageMemoryBarrier layout_barrier (const image_copy &copy, vk::ImageLayout old_layout,
+                                                  vk::ImageLayout new_layout, vk::AccessFlags src_access,
+                                                  vk::AccessFlags dst_access)
+    {
+        vk::ImageMemoryBarrier barrier {};
+        barrier.srcAccessMask       = src_access;
+        barrier.dstAccessMask       = dst_access;
+        barrier.oldLayout           = old_layout;
+        barrier.newLayout           = new_layout;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.image               = copy.destination;
+        barrier.subresourceRange    = vk::ImageSubresourceRange {copy.region.imageSubresource.aspectMask,
+                                                                 copy.region.imageSubresource.mipLevel, 1,
+                                                                 copy.region.imageSubresource.baseArrayLayer,
+                                                                 copy.region.imageSubresource.layerCount};
+        return barrier;
+    }
+};
+
+}   // namespace vk_utils
+}   // namespace graphics
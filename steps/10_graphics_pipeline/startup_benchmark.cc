@@ -0,0 +1,137 @@
+#include "engine.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+/*
+ * Creates and destroys the engine over and over and reports how long every startup stage took.
+ * Runs headless by default, so it works on a software ICD such as lavapipe, e.g.
+ *
+ *     VK_ICD_FILENAMES=/usr/share/vulkan/icd.d/lvp_icd.x86_64.json \
+ *         ./10_graphics_pipeline_startup_benchmark --runs 50 --format json --output startup.json
+ */
+
+namespace
+{
+
+using graphics::vk_utils::add_sample;
+using graphics::vk_utils::sample_series;
+
+void write_csv (std::ostream &out, const std::vector<sample_series> &stages)
+{
+    out << "stage,runs,median_ms,p95_ms,min_ms,max_ms\n";
+    for ( auto &stage : stages )
+        out << '"' << stage.name << "\"," << stage.count () << ',' << stage.median_ms () << ','
+            << stage.percentile_ms (0.95) << ',' << stage.min_ms () << ',' << stage.max_ms () << '\n';
+}
+
+void write_json (std::ostream &out, const std::vector<sample_series> &stages)
+{
+    out << "{\n  \"stages\": [\n";
+    for ( std::size_t i = 0; i < stages.size (); ++i )
+    {
+        const sample_series &stage = stages[i];
+        out << "    {\"stage\": \"" << stage.name << "\", \"runs\": " << stage.count ()
+            << ", \"median_ms\": " << stage.median_ms () << ", \"p95_ms\": " << stage.percentile_ms (0.95)
+            << ", \"min_ms\": " << stage.min_ms () << ", \"max_ms\": " << stage.max_ms () << "}"
+            << (i + 1 < stages.size () ? "," : "") << '\n';
+    }
+    out << "  ]\n}\n";
+}
+
+}   // namespace
+
+int main (int argc, char **argv)
+{
+    graphics::engine_create_info info {};
+    info.headless = true;
+    // empty paths measure cold pipeline and capability caches on every run
+    info.pipeline_cache_path   = "";
+    info.capability_cache_path = "";
+
+    uint32_t runs        = 20;
+    uint32_t warmup_runs = 1;
+    std::string format   = "csv";
+    std::string output_path;
+
+    for ( int i = 1; i < argc; ++i )
+    {
+        if ( !std::strcmp (argv[i], "--runs") && i + 1 < argc )
+            runs = std::max (std::stoul (argv[++i]), 1ul);
+        else if ( !std::strcmp (argv[i], "--warmup") && i + 1 < argc )
+            warmup_runs = std::stoul (argv[++i]);
+        else if ( !std::strcmp (argv[i], "--format") && i + 1 < argc )
+            format = argv[++i];
+        else if ( !std::strcmp (argv[i], "--output") && i + 1 < argc )
+            output_path = argv[++i];
+        else if ( !std::strcmp (argv[i], "--window") )
+            info.headless = false;
+        else if ( !std::strcmp (argv[i], "--device-uuid") && i + 1 < argc )
+            info.device_uuid = graphics::vkinit::parse_device_uuid (argv[++i]);
+        else if ( !std::strcmp (argv[i], "--validation") )
+            info.validation = true;
+        else if ( !std::strcmp (argv[i], "--pipeline-cache") && i + 1 < argc )
+            info.pipeline_cache_path = argv[++i];
+        else if ( !std::strcmp (argv[i], "--capability-cache") && i + 1 < argc )
+            info.capability_cache_path = argv[++i];
+    }
+
+    if ( format != "csv" && format != "json" )
+    {
+        std::cerr << "Unknown format \"" << format << "\", expected csv or json" << std::endl;
+        return 1;
+    }
+
+    // startup logging would otherwise be part of what we measure
+    graphics::vk_utils::logger::instance ().set_level (graphics::vk_utils::log_level::warning);
+
+    std::vector<sample_series> stages;
+    for ( uint32_t run = 0; run < warmup_runs + runs; ++run )
+    {
+        bool measured = run >= warmup_runs;
+
+        using clock        = std::chrono::steady_clock;
+        using milliseconds = std::chrono::duration<double, std::milli>;
+
+        clock::time_point destroying;
+        clock::time_point creating = clock::now ();
+        {
+            graphics::engine engine {info};
+            milliseconds constructing = clock::now () - creating;
+
+            if ( measured )
+            {
+                for ( auto &stage : engine.startup_timings ().stages () )
+                    add_sample (stages, stage.name, stage.milliseconds);
+                add_sample (stages, "total", constructing.count ());
+            }
+            destroying = clock::now ();
+        }
+        milliseconds shutdown = clock::now () - destroying;
+
+        if ( measured )
+            add_sample (stages, "shutdown", shutdown.count ());
+    }
+
+    std::ofstream file;
+    if ( !output_path.empty () )
+    {
+        file.open (output_path);
+        if ( !file.is_open () )
+        {
+            std::cerr << "Can't open \"" << output_path << "\" for writing" << std::endl;
+            return 1;
+        }
+    }
+    std::ostream &out = output_path.empty () ? std::cout : file;
+
+    if ( format == "json" )
+        write_json (out, stages);
+    else
+        write_csv (out, stages);
+}
@@ -4,8 +4,16 @@
 #define GLFW_INCLUDE_NONE
 #include <GLFW/glfw3.h>
 
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "capabilities.hpp"
 #include "frames.hpp"
+#include "logger.hpp"
+#include "logging.hpp"
 #include "queues.hpp"
+#include "sync.hpp"
 
 namespace graphics
 {
@@ -45,7 +53,8 @@ struct swapchain_bundle
             create_info.subresourceRange.layerCount     = 1;
             create_info.format                          = m_format;
 
-            m_frames.push_back (vk_utils::swapchain_frame {image, l_device.createImageView (create_info)});
+            m_frames.push_back (vk_utils::swapchain_frame {image, l_device.createImageView (create_info), nullptr,
+                                                           make_semaphore (l_device)});
         }
     }
 
@@ -53,6 +62,34 @@ struct swapchain_bundle
     std::vector<vk_utils::swapchain_frame> m_frames;
     vk::Format m_format;
     vk::Extent2D m_extent;
+    vk::PresentModeKHR m_present_mode = vk::PresentModeKHR::eFifo;
+};
+
+enum class present_policy
+{
+    low_latency,      // newest frame wins, the CPU is never throttled by a deep queue
+    max_throughput,   // present as fast as possible, tearing is acceptable
+    power_saver,      // locked to vblank with as few images as possible
+};
+
+inline std::string to_string (present_policy policy)
+{
+    switch ( policy )
+    {
+    case present_policy::low_latency:
+        return "low latency";
+    case present_policy::max_throughput:
+        return "max throughput";
+    case present_policy::power_saver:
+        return "power saver";
+    }
+    return "unknown";
+}
+
+struct present_choice
+{
+    vk::PresentModeKHR present_mode;
+    uint32_t image_count;
 };
 
 static vk::SurfaceFormatKHR choose_swapchain_surface_format (const std::vector<vk::SurfaceFormatKHR> &formats)
@@ -63,12 +100,58 @@ static vk::SurfaceFormatKHR choose_swapchain_surface_format (const std::vector<v
     return formats[0];
 }
 
-static vk::PresentModeKHR choose_swapchain_present_mode (const std::vector<vk::PresentModeKHR> &present_modes)
+// maxImageCount == 0 means there is no upper limit
+static uint32_t clamp_image_count (uint32_t desired, const vk::SurfaceCapabilitiesKHR &capabilities)
+{
+    uint32_t count = std::max (desired, capabilities.minImageCount);
+    if ( capabilities.maxImageCount )
+        count = std::min (count, capabilities.maxImageCount);
+    return count;
+}
+
+/*
+ * The present mode and the number of images only make sense together: mailbox needs a spare image to
+ * never block, while every extra image in a FIFO queue is another frame of latency.
+ */
+static present_choice choose_present_policy (present_policy policy,
+                                             const std::vector<vk::PresentModeKHR> &present_modes,
+                                             const vk::SurfaceCapabilitiesKHR &capabilities)
 {
-    for ( auto &mode : present_modes )
-        if ( mode == vk::PresentModeKHR::eMailbox )   // The fastest one
-            return mode;
-    return vk::PresentModeKHR::eFifo;
+    auto supported = [&present_modes] (vk::PresentModeKHR mode) {
+        return std::find (present_modes.begin (), present_modes.end (), mode) != present_modes.end ();
+    };
+
+    // FIFO is the only mode every implementation has to support
+    present_choice choice {vk::PresentModeKHR::eFifo, capabilities.minImageCount};
+
+    switch ( policy )
+    {
+    case present_policy::low_latency:
+        if ( supported (vk::PresentModeKHR::eMailbox) )
+            choice = {vk::PresentModeKHR::eMailbox, std::max (capabilities.minImageCount + 1, 3u)};
+        else if ( supported (vk::PresentModeKHR::eImmediate) )
+            choice = {vk::PresentModeKHR::eImmediate, capabilities.minImageCount + 1};
+        break;
+    case present_policy::max_throughput:
+        if ( supported (vk::PresentModeKHR::eImmediate) )
+            choice = {vk::PresentModeKHR::eImmediate, capabilities.minImageCount + 1};
+        else if ( supported (vk::PresentModeKHR::eMailbox) )
+            choice = {vk::PresentModeKHR::eMailbox, std::max (capabilities.minImageCount + 1, 3u)};
+        else if ( supported (vk::PresentModeKHR::eFifoRelaxed) )
+            choice = {vk::PresentModeKHR::eFifoRelaxed, capabilities.minImageCount + 1};
+        else
+            choice.image_count = capabilities.minImageCount + 1;
+        break;
+    case present_policy::power_saver:
+        break;
+    }
+
+    choice.image_count = clamp_image_count (choice.image_count, capabilities);
+
+    GRAPHICS_LOG_INFO ("Present policy \"" << to_string (policy) << "\" chose " << vk::to_string (choice.present_mode)
+                                             << " with " << choice.image_count << " image(s)");
+
+    return choice;
 }
 
 static vk::Extent2D choose_swapchain_extent (uint32_t width, uint32_t height,
@@ -90,70 +173,49 @@ static vk::Extent2D choose_swapchain_extent (uint32_t width, uint32_t height,
     }
 }
 
-static swapchain_support_details query_swapchain_support (vk::raii::PhysicalDevice &p_device,
-                                                          vk::raii::SurfaceKHR &surface)
+// Everything the surface supports, only worth formatting when debug messages are kept
+static void log_swapchain_support (const swapchain_support_details &support)
 {
-    swapchain_support_details support;
-    support.capabilities = p_device.getSurfaceCapabilitiesKHR (*surface);
-    /*
-    uint32_t                                          minImageCount           = {};
-    uint32_t                                          maxImageCount           = {};
-    VULKAN_HPP_NAMESPACE::Extent2D                    currentExtent           = {};
-    VULKAN_HPP_NAMESPACE::Extent2D                    minImageExtent          = {};
-    VULKAN_HPP_NAMESPACE::Extent2D                    maxImageExtent          = {};
-    uint32_t                                          maxImageArrayLayers     = {};
-    VULKAN_HPP_NAMESPACE::SurfaceTransformFlagsKHR    supportedTransforms     = {};
-    VULKAN_HPP_NAMESPACE::SurfaceTransformFlagBitsKHR currentTransform        =
-    VULKAN_HPP_NAMESPACE::SurfaceTransformFlagBitsKHR::eIdentity; VULKAN_HPP_NAMESPACE::CompositeAlphaFlagsKHR
-    supportedCompositeAlpha = {}; VULKAN_HPP_NAMESPACE::ImageUsageFlags             supportedUsageFlags     = {};
-    */
+    GRAPHICS_LOG_DEBUG ("Swapchain can support the following surface capabilities:");
 
-    std::cout << "Swapchain can support the following surface capabilities:\n";
+    GRAPHICS_LOG_DEBUG ("\tminimum image count: " << support.capabilities.minImageCount);
+    GRAPHICS_LOG_DEBUG ("\tmaximum image count: " << support.capabilities.maxImageCount);
 
-    std::cout << "\tminimum image count: " << support.capabilities.minImageCount << std::endl;
-    std::cout << "\tmaximum image count: " << support.capabilities.maxImageCount << std::endl;
-
-    std::cout << "\tcurrent extent: \n";
+    GRAPHICS_LOG_DEBUG ("\tcurrent extent: ");
     /*
     struct Extent2D {
             uint32_t    width;
             uint32_t    height;
     };
     */
-    std::cout << "\t\twidth: " << support.capabilities.currentExtent.width << std::endl;
-    std::cout << "\t\theight: " << support.capabilities.currentExtent.height << std::endl;
-
-    std::cout << "\tminimum supported extent: \n";
-    std::cout << "\t\twidth: " << support.capabilities.minImageExtent.width << std::endl;
-    std::cout << "\t\theight: " << support.capabilities.minImageExtent.height << std::endl;
+    GRAPHICS_LOG_DEBUG ("\t\twidth: " << support.capabilities.currentExtent.width);
+    GRAPHICS_LOG_DEBUG ("\t\theight: " << support.capabilities.currentExtent.height);
 
-    std::cout << "\tmaximum supported extent: \n";
-    std::cout << "\t\twidth: " << support.capabilities.maxImageExtent.width << std::endl;
-    std::cout << "\t\theight: " << support.capabilities.maxImageExtent.height << std::endl;
+    GRAPHICS_LOG_DEBUG ("\tminimum supported extent: ");
+    GRAPHICS_LOG_DEBUG ("\t\twidth: " << support.capabilities.minImageExtent.width);
+    GRAPHICS_LOG_DEBUG ("\t\theight: " << support.capabilities.minImageExtent.height);
 
-    std::cout << "\tmaximum image array layers: " << support.capabilities.maxImageArrayLayers << std::endl;
+    GRAPHICS_LOG_DEBUG ("\tmaximum supported extent: ");
+    GRAPHICS_LOG_DEBUG ("\t\twidth: " << support.capabilities.maxImageExtent.width);
+    GRAPHICS_LOG_DEBUG ("\t\theight: " << support.capabilities.maxImageExtent.height);
 
-    std::cout << "\tsupported transforms:\n";
-    std::vector<std::string> stringList = log_transform_bits (support.capabilities.supportedTransforms);
-    for ( auto &line : stringList )
-        std::cout << "\t\t" << line << std::endl;
+    GRAPHICS_LOG_DEBUG ("\tmaximum image array layers: " << support.capabilities.maxImageArrayLayers);
 
-    std::cout << "\tcurrent transform:\n";
-    stringList = log_transform_bits (support.capabilities.currentTransform);
-    for ( auto &line : stringList )
-        std::cout << "\t\t" << line << std::endl;
+    GRAPHICS_LOG_DEBUG ("\tsupported transforms:");
+    for ( auto &line : log_transform_bits (support.capabilities.supportedTransforms) )
+        GRAPHICS_LOG_DEBUG ("\t\t" << line);
 
-    std::cout << "\tsupported alpha operations:\n";
-    stringList = log_alpha_composite_bits (support.capabilities.supportedCompositeAlpha);
-    for ( auto &line : stringList )
-        std::cout << "\t\t" << line << std::endl;
+    GRAPHICS_LOG_DEBUG ("\tcurrent transform:");
+    for ( auto &line : log_transform_bits (support.capabilities.currentTransform) )
+        GRAPHICS_LOG_DEBUG ("\t\t" << line);
 
-    std::cout << "\tsupported image usage:\n";
-    stringList = log_image_usage_bits (support.capabilities.supportedUsageFlags);
-    for ( auto &line : stringList )
-        std::cout << "\t\t" << line << std::endl;
+    GRAPHICS_LOG_DEBUG ("\tsupported alpha operations:");
+    for ( auto &line : log_alpha_composite_bits (support.capabilities.supportedCompositeAlpha) )
+        GRAPHICS_LOG_DEBUG ("\t\t" << line);
 
-    support.formats = p_device.getSurfaceFormatsKHR (*surface);
+    GRAPHICS_LOG_DEBUG ("\tsupported image usage:");
+    for ( auto &line : log_image_usage_bits (support.capabilities.supportedUsageFlags) )
+        GRAPHICS_LOG_DEBUG ("\t\t" << line);
 
     for ( auto &supportedFormat : support.formats )
     {
@@ -164,28 +226,54 @@ static swapchain_support_details query_swapchain_support (vk::raii::PhysicalDevi
         } VkSurfaceFormatKHR;
         */
 
-        std::cout << "supported pixel format: " << vk::to_string (supportedFormat.format) << '\n';
-        std::cout << "supported color space: " << vk::to_string (supportedFormat.colorSpace) << '\n';
+        GRAPHICS_LOG_DEBUG ("supported pixel format: " << vk::to_string (supportedFormat.format));
+        GRAPHICS_LOG_DEBUG ("supported color space: " << vk::to_string (supportedFormat.colorSpace));
     }
 
-    support.present_modes = p_device.getSurfacePresentModesKHR (*surface);
-
     for ( auto &present_mode : support.present_modes )
-    {
-        std::cout << '\t' << log_present_mode (present_mode) << '\n';
-    }
+        GRAPHICS_LOG_DEBUG ('\t' << log_present_mode (present_mode));
+}
+
+// Formats and present modes come from the snapshot, only the capabilities change with the window size
+static swapchain_support_details query_swapchain_support (vk::raii::PhysicalDevice &p_device,
+                                                          vk::raii::SurfaceKHR &surface,
+                                                          const surface_support &snapshot)
+{
+    swapchain_support_details support;
+    support.capabilities = p_device.getSurfaceCapabilitiesKHR (*surface);
+    /*
+    uint32_t                                          minImageCount           = {};
+    uint32_t                                          maxImageCount           = {};
+    VULKAN_HPP_NAMESPACE::Extent2D                    currentExtent           = {};
+    VULKAN_HPP_NAMESPACE::Extent2D                    minImageExtent          = {};
+    VULKAN_HPP_NAMESPACE::Extent2D                    maxImageExtent          = {};
+    uint32_t                                          maxImageArrayLayers     = {};
+    VULKAN_HPP_NAMESPACE::SurfaceTransformFlagsKHR    supportedTransforms     = {};
+    VULKAN_HPP_NAMESPACE::SurfaceTransformFlagBitsKHR currentTransform        =
+    VULKAN_HPP_NAMESPACE::SurfaceTransformFlagBitsKHR::eIdentity; VULKAN_HPP_NAMESPACE::CompositeAlphaFlagsKHR
+    supportedCompositeAlpha = {}; VULKAN_HPP_NAMESPACE::ImageUsageFlags             supportedUsageFlags     = {};
+    */
+
+    support.formats       = snapshot.formats;
+    support.present_modes = snapshot.present_modes;
+
+    if ( GRAPHICS_LOG_ENABLED (debug) )
+        log_swapchain_support (support);
 
     return support;
 }
 
+// Passing the swapchain being replaced as old_swapchain lets the driver reuse its resources
 static swapchain_bundle create_swapchain (vk::raii::Device &logical_device, vk::raii::PhysicalDevice &phys_device,
-                                          vk::raii::SurfaceKHR &surface, uint32_t width, uint32_t height)
+                                          vk::raii::SurfaceKHR &surface, const device_capabilities &capabilities,
+                                          const queue_family_indices &indices, uint32_t width, uint32_t height,
+                                          present_policy policy = present_policy::low_latency,
+                                          vk::SwapchainKHR old_swapchain = nullptr)
 {
-    swapchain_support_details support = query_swapchain_support (phys_device, surface);
+    swapchain_support_details support = query_swapchain_support (phys_device, surface, capabilities.surface);
     vk::SurfaceFormatKHR format       = choose_swapchain_surface_format (support.formats);
-    vk::PresentModeKHR present_mode   = choose_swapchain_present_mode (support.present_modes);
+    present_choice present            = choose_present_policy (policy, support.present_modes, support.capabilities);
     vk::Extent2D extent               = choose_swapchain_extent (width, height, support.capabilities);
-    uint32_t image_count = std::max (support.capabilities.maxImageCount, support.capabilities.minImageCount + 1);
 
     /*
                 * VULKAN_HPP_CONSTEXPR SwapchainCreateInfoKHR(
@@ -208,11 +296,14 @@ static swapchain_bundle create_swapchain (vk::raii::Device &logical_device, vk::
       VULKAN_HPP_NAMESPACE::Bool32         clipped_      = {},
       VULKAN_HPP_NAMESPACE::SwapchainKHR   oldSwapchain_ = {} ) VULKAN_HPP_NOEXCEPT
                 */
-    vk::SwapchainCreateInfoKHR create_info {
-        vk::SwapchainCreateFlagsKHR (),          *surface, image_count, format.format, format.colorSpace, extent, 1,
-        vk::ImageUsageFlagBits::eColorAttachment};
-    queue_family_indices indices = find_queue_families (phys_device, surface);
-
+    vk::SwapchainCreateInfoKHR create_info {vk::SwapchainCreateFlagsKHR (),
+                                            *surface,
+                                            present.image_count,
+                                            format.format,
+                                            format.colorSpace,
+                                            extent,
+                                            1,
+                                            vk::ImageUsageFlagBits::eColorAttachment};
     uint32_t queue_family_indices[] = {indices.graphics_family.value (), indices.present_family.value ()};
 
     if ( indices.graphics_family.value () != indices.present_family.value () )
@@ -226,10 +317,16 @@ static swapchain_bundle create_swapchain (vk::raii::Device &logical_device, vk::
 
     create_info.preTransform   = support.capabilities.currentTransform;
     create_info.compositeAlpha = vk::CompositeAlphaFlagBitsKHR::eOpaque;
-    create_info.presentMode    = present_mode;
+    create_info.presentMode    = present.present_mode;
     create_info.clipped        = VK_TRUE;
+    create_info.oldSwapchain   = old_swapchain;
 
     swapchain_bundle bundle {logical_device, create_info};
+    bundle.m_present_mode = present.present_mode;
+
+    // the driver may hand out more images than we asked for
+    GRAPHICS_LOG_INFO ("Swapchain has " << bundle.m_frames.size () << " image(s)");
+
     return bundle;
 }
 
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <vulkan/vulkan_raii.hpp>
+
+namespace graphics
+{
+namespace vkinit
+{
+
+inline vk::raii::Semaphore make_semaphore (vk::raii::Device &device)
+{
+    vk::SemaphoreCreateInfo semaphore_info {};
+    semaphore_info.flags = vk::SemaphoreCreateFlags ();
+    return device.createSemaphore (semaphore_info);
+}
+
+// Timeline semaphores count up from initial_value, see vk_utils::queue_timeline
+inline vk::raii::Semaphore make_timeline_semaphore (vk::raii::Device &device, uint64_t initial_value = 0)
+{
+    vk::SemaphoreTypeCreateInfo type_info {};
+    type_info.semaphoreType = vk::SemaphoreType::eTimeline;
+    type_info.initialValue  = initial_value;
+
+    vk::SemaphoreCreateInfo semaphore_info {};
+    semaphore_info.pNext = &type_info;
+    semaphore_info.flags = vk::SemaphoreCreateFlags ();
+    return device.createSemaphore (semaphore_info);
+}
+
+}   // namespace vkinit
+}   // namespace graphics
@@ -0,0 +1,192 @@
+#pragma once
+
+#include "sync.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+#include <vulkan/vulkan_raii.hpp>
+
+#include "queues.hpp"
+
+namespace graphics
+{
+namespace vk_utils
+{
+
+struct queue_timeline;
+
+/*
+ * Everything one vkQueueSubmit needs besides the timeline signal, which queue_timeline::submit () adds. Binary
+ * semaphores are still needed around the swapchain, vkAcquireNextImageKHR and vkQueuePresentKHR can't use
+ * timelines.
+ */
+struct submit_batch
+{
+    std::vector<vk::CommandBuffer> command_buffers;
+    std::vector<vk::Semaphore> wait_semaphores;
+    std::vector<uint64_t> wait_values;   // ignored for binary semaphores
+    std::vector<vk::PipelineStageFlags> wait_stages;
+    std::vector<vk::Semaphore> signal_semaphores;
+    std::vector<uint64_t> signal_values;
+
+    void wait (vk::Semaphore binary_semaphore, vk::PipelineStageFlags stage)
+    {
+        wait_semaphores.push_back (binary_semaphore);
+        wait_values.push_back (0);
+        wait_stages.push_back (stage);
+    }
+
+    // Waits for another queue's work, a value that was never submitted would deadlock the GPU
+    inline void wait (const queue_timeline &timeline, uint64_t value, vk::PipelineStageFlags stage);
+
+    void signal (vk::Semaphore binary_semaphore)
+    {
+        signal_semaphores.push_back (binary_semaphore);
+        signal_values.push_back (0);
+    }
+};
+
+/*
+ * One timeline semaphore per queue. Every submission signals the next value, so "value X has completed" means
+ * the first X submissions to the queue are done, and anything (frames, deferred deletion, readbacks, uploads)
+ * can be tracked with a single uint64_t instead of a fence of its own.
+ */
+struct queue_timeline
+{
+    queue_timeline (vk::raii::Device &device, const vk::raii::Queue &queue)
+        : m_device {&device}, m_queue {queue}, m_semaphore {vkinit::make_timeline_semaphore (device)}
+    {}
+
+    queue_timeline (const queue_timeline &)             = delete;
+    queue_timeline &operator= (const queue_timeline &) = delete;
+
+    // Submits the batch and returns the value the timeline reaches once it has executed
+    uint64_t submit (submit_batch &batch)
+    {
+        std::lock_guard<std::mutex> lock {m_mutex};   // vkQueueSubmit needs the queue externally synchronized
+
+        uint64_t value = m_last_submitted + 1;
+        batch.signal_semaphores.push_back (*m_semaphore);
+        batch.signal_values.push_back (value);
+
+        vk::TimelineSemaphoreSubmitInfo timeline_info {};
+        timeline_info.waitSemaphoreValueCount   = static_cast<uint32_t> (batch.wait_values.size ());
+        timeline_info.pWaitSemaphoreValues      = batch.wait_values.data ();
+        timeline_info.signalSemaphoreValueCount = static_cast<uint32_t> (batch.signal_values.size ());
+        timeline_info.pSignalSemaphoreValues    = batch.signal_values.data ();
+
+        vk::SubmitInfo submit_info       = {};
+        submit_info.pNext                = &timeline_info;
+        submit_info.waitSemaphoreCount   = static_cast<uint32_t> (batch.wait_semaphores.size ());
+        submit_info.pWaitSemaphores      = batch.wait_semaphores.data ();
+        submit_info.pWaitDstStageMask    = batch.wait_stages.data ();
+        submit_info.commandBufferCount   = static_cast<uint32_t> (batch.command_buffers.size ());
+        submit_info.pCommandBuffers      = batch.command_buffers.data ();
+        submit_info.signalSemaphoreCount = static_cast<uint32_t> (batch.signal_semaphores.size ());
+        submit_info.pSignalSemaphores    = batch.signal_semaphores.data ();
+
+        m_queue.submit (submit_info);
+        m_last_submitted = value;
+        return value;
+    }
+
+    // Polls without blocking, the result is cached so asking for already completed values is free
+    uint64_t completed () const
+    {
+        uint64_t last = m_last_completed.load (std::memory_order_acquire);
+        if ( last < last_submitted () )
+            last = raise_completed (m_semaphore.getCounterValue ());
+        return last;
+    }
+
+    bool is_complete (uint64_t value) const
+    {
+        return value <= m_last_completed.load (std::memory_order_acquire) || value <= completed ();
+    }
+
+    // Blocks the CPU through vkWaitSemaphores, returns false on timeout
+    bool wait (uint64_t value, uint64_t timeout = UINT64_MAX) const
+    {
+        if ( is_complete (value) )
+            return true;
+
+        vk::Semaphore semaphores[] = {*m_semaphore};
+        uint64_t values[]          = {value};
+
+        vk::SemaphoreWaitInfo wait_info {};
+        wait_info.semaphoreCount = 1;
+        wait_info.pSemaphores    = semaphores;
+        wait_info.pValues        = values;
+
+        if ( m_device->waitSemaphores (wait_info, timeout) == vk::Result::eTimeout )
+            return false;
+
+        raise_completed (value);
+        return true;
+    }
+
+    void wait_idle () const { wait (last_submitted ()); }
+
+    uint64_t last_submitted () const
+    {
+        std::lock_guard<std::mutex> lock {m_mutex};
+        return m_last_submitted;
+    }
+
+    vk::Semaphore semaphore () const { return *m_semaphore; }
+
+  private:
+    vk::raii::Device *m_device = nullptr;
+    vk::raii::Queue m_queue;
+    vk::raii::Semaphore m_semaphore;
+    mutable std::mutex m_mutex;
+    uint64_t m_last_submitted = 0;
+    mutable std::atomic<uint64_t> m_last_completed {0};
+
+    // the cached value only ever moves forward, even when several threads poll at once
+    uint64_t raise_completed (uint64_t value) const
+    {
+        uint64_t last = m_last_completed.load (std::memory_order_acquire);
+        while ( last < value && !m_last_completed.compare_exchange_weak (last, value, std::memory_order_acq_rel) )
+            ;
+        return std::max (last, value);
+    }
+};
+
+// One timeline per VkQueue: roles without a dedicated family share the graphics queue and so its timeline
+struct device_timelines
+{
+    device_timelines (vk::raii::Device &device, const vkinit::device_queues &queues)
+        : m_graphics {std::make_unique<queue_timeline> (device, queues.graphics)}
+    {
+        if ( queues.dedicated_transfer () )
+            m_transfer = std::make_unique<queue_timeline> (device, queues.transfer);
+        if ( queues.dedicated_compute () )
+            m_compute = std::make_unique<queue_timeline> (device, queues.compute);
+    }
+
+    queue_timeline &graphics () { return *m_graphics; }
+    queue_timeline &transfer () { return m_transfer ? *m_transfer : *m_graphics; }
+    queue_timeline &compute () { return m_compute ? *m_compute : *m_graphics; }
+
+  private:
+    std::unique_ptr<queue_timeline> m_graphics;
+    std::unique_ptr<queue_timeline> m_transfer;
+    std::unique_ptr<queue_timeline> m_compute;
+};
+
+inline void submit_batch::wait (const queue_timeline &timeline, uint64_t value, vk::PipelineStageFlags stage)
+{
+    wait_semaphores.push_back (timeline.semaphore ());
+    wait_values.push_back (value);
+    wait_stages.push_back (stage);
+}
+
+}   // namespace vk_utils
+}   // namespace graphics
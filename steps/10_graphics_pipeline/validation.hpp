@@ -0,0 +1,195 @@
+#pragma once
+
+#include "logger.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <vulkan/vulkan_raii.hpp>
+
+namespace graphics
+{
+namespace vk_utils
+{
+
+struct validation_settings
+{
+    // messages below this severity aren't even subscribed to, so the layer doesn't format them
+    vk::DebugUtilsMessageSeverityFlagBitsEXT min_severity = vk::DebugUtilsMessageSeverityFlagBitsEXT::eWarning;
+    // best practice and performance warnings, useful when profiling
+    bool performance_warnings = true;
+    // every message ID is logged at most this many times per window, the rest are only counted
+    uint32_t messages_per_window          = 3;
+    std::chrono::milliseconds rate_window = std::chrono::seconds {10};
+};
+
+/*
+ * Sits between the debug messenger and the logger. The callback runs inside whatever Vulkan call triggered
+ * it, so it only bumps a per-ID counter and, unless that ID is over its rate limit, hands the message to the
+ * asynchronous logger. The counters survive the rate limit and can be read back at any time.
+ */
+struct validation_filter
+{
+    struct message_counter
+    {
+        int32_t id = 0;
+        std::string name;
+        vk::DebugUtilsMessageSeverityFlagBitsEXT severity = vk::DebugUtilsMessageSeverityFlagBitsEXT::eVerbose;
+        vk::DebugUtilsMessageTypeFlagsEXT types;
+        uint64_t count      = 0;
+        uint64_t suppressed = 0;   // counted but not logged because of the rate limit
+    };
+
+    validation_filter (const validation_settings &settings = {})
+        : m_settings {settings}, m_subscribed_min_severity {settings.min_severity}
+    {}
+
+    validation_filter (const validation_filter &)             = delete;
+    validation_filter &operator= (const validation_filter &) = delete;
+
+    /*
+     * The messenger only subscribes to the severities at or above the initial minimum, so at runtime it can be
+     * raised and lowered again, but never below that initial value. Lower requests are clamped to it.
+     */
+    void set_min_severity (vk::DebugUtilsMessageSeverityFlagBitsEXT severity)
+    {
+        std::lock_guard<std::mutex> lock {m_mutex};
+        m_settings.min_severity = std::max (severity, m_subscribed_min_severity);
+    }
+
+    const validation_settings &settings () const { return m_settings; }
+
+    vk::DebugUtilsMessageSeverityFlagsEXT subscribed_severities () const
+    {
+        vk::DebugUtilsMessageSeverityFlagsEXT severities;
+        for ( auto severity :
+              {vk::DebugUtilsMessageSeverityFlagBitsEXT::eVerbose, vk::DebugUtilsMessageSeverityFlagBitsEXT::eInfo,
+               vk::DebugUtilsMessageSeverityFlagBitsEXT::eWarning, vk::DebugUtilsMessageSeverityFlagBitsEXT::eError} )
+            if ( severity >= m_subscribed_min_severity )
+                severities |= severity;
+        return severities;
+    }
+
+    vk::DebugUtilsMessageTypeFlagsEXT subscribed_types () const
+    {
+        vk::DebugUtilsMessageTypeFlagsEXT types =
+            vk::DebugUtilsMessageTypeFlagBitsEXT::eGeneral | vk::DebugUtilsMessageTypeFlagBitsEXT::eValidation;
+        if ( m_settings.performance_warnings )
+            types |= vk::DebugUtilsMessageTypeFlagBitsEXT::ePerformance;
+        return types;
+    }
+
+    void handle (vk::DebugUtilsMessageSeverityFlagBitsEXT severity, vk::DebugUtilsMessageTypeFlagsEXT types,
+                 const VkDebugUtilsMessengerCallbackDataEXT &data)
+    {
+        auto now = std::chrono::steady_clock::now ();
+        {
+            std::lock_guard<std::mutex> lock {m_mutex};
+            if ( severity < m_settings.min_severity )
+                return;
+
+            tracked_message &message = m_messages[data.messageIdNumber];
+            if ( !message.counter.count )
+            {
+                message.counter.id   = data.messageIdNumber;
+                message.counter.name = data.pMessageIdName ? data.pMessageIdName : "";
+                message.window_start = now;
+            }
+            message.counter.severity = std::max (message.counter.severity, severity);
+            message.counter.types |= types;
+            ++message.counter.count;
+            ++m_total;
+
+            if ( now - message.window_start >= m_settings.rate_window )
+            {
+                message.window_start = now;
+                message.window_count = 0;
+            }
+            if ( message.window_count++ >= m_settings.messages_per_window )
+            {
+                ++message.counter.suppressed;
+                return;
+            }
+        }
+
+        const char *kind = types & vk::DebugUtilsMessageTypeFlagBitsEXT::ePerformance ? "performance" : "validation";
+        if ( severity >= vk::DebugUtilsMessageSeverityFlagBitsEXT::eError )
+            GRAPHICS_LOG_ERROR (kind << " layer: " << data.pMessage);
+        else if ( severity >= vk::DebugUtilsMessageSeverityFlagBitsEXT::eWarning )
+            GRAPHICS_LOG_WARNING (kind << " layer: " << data.pMessage);
+        // asking for info or verbose messages is the opt-in, so they aren't filtered again by the logger
+        else
+            GRAPHICS_LOG_INFO (kind << " layer: " << data.pMessage);
+    }
+
+    // Snapshot of the per-ID counters, most frequent first
+    std::vector<message_counter> counters () const
+    {
+        std::vector<message_counter> result;
+        {
+            std::lock_guard<std::mutex> lock {m_mutex};
+            result.reserve (m_messages.size ());
+            for ( auto &[id, message] : m_messages )
+                result.push_back (message.counter);
+        }
+        std::sort (result.begin (), result.end (),
+                   [] (const message_counter &a, const message_counter &b) { return a.count > b.count; });
+        return result;
+    }
+
+    uint64_t total () const
+    {
+        std::lock_guard<std::mutex> lock {m_mutex};
+        return m_total;
+    }
+
+    void report (std::ostream &stream) const
+    {
+        std::vector<message_counter> snapshot = counters ();
+
+        stream << "Validation: " << total () << " message(s) with " << snapshot.size () << " distinct ID(s)"
+               << std::endl;
+        for ( auto &counter : snapshot )
+            stream << "\t" << std::setw (8) << counter.count << "  " << vk::to_string (counter.severity) << "  "
+                   << (counter.name.empty () ? "<unnamed>" : counter.name) << " (0x" << std::hex
+                   << static_cast<uint32_t> (counter.id) << std::dec << ")"
+                   << (counter.suppressed ? ", " + std::to_string (counter.suppressed) + " suppressed" : "")
+                   << std::endl;
+    }
+
+    static VKAPI_ATTR VkBool32 VKAPI_CALL callback (VkDebugUtilsMessageSeverityFlagBitsEXT severity,
+                                                    VkDebugUtilsMessageTypeFlagsEXT types,
+                                                    const VkDebugUtilsMessengerCallbackDataEXT *data, void *user_data)
+    {
+        static_cast<validation_filter *> (user_data)->handle (
+            static_cast<vk::DebugUtilsMessageSeverityFlagBitsEXT> (severity),
+            vk::DebugUtilsMessageTypeFlagsEXT (types), *data);
+
+        // the call that triggered the message must not be aborted
+        return VK_FALSE;
+    }
+
+  private:
+    struct tracked_message
+    {
+        message_counter counter;
+        std::chrono::steady_clock::time_point window_start;
+        uint32_t window_count = 0;
+    };
+
+    validation_settings m_settings;
+    vk::DebugUtilsMessageSeverityFlagBitsEXT m_subscribed_min_severity;   // what the messenger was created with
+    mutable std::mutex m_mutex;
+    std::unordered_map<int32_t, tracked_message> m_messages;
+    uint64_t m_total = 0;
+};
+
+}   // namespace vk_utils
+}   // namespace graphics
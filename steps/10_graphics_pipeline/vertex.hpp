@@ -0,0 +1,149 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+#include <vulkan/vulkan.hpp>
+
+namespace graphics
+{
+namespace vk_utils
+{
+
+// C++ attribute type -> vertex attribute format, add a specialization for every type a vertex may contain
+template <typename attribute_type> struct vertex_format;
+
+template <> struct vertex_format<float>
+{
+    static constexpr vk::Format value = vk::Format::eR32Sfloat;
+};
+template <> struct vertex_format<std::array<float, 2>>
+{
+    static constexpr vk::Format value = vk::Format::eR32G32Sfloat;
+};
+template <> struct vertex_format<std::array<float, 3>>
+{
+    static constexpr vk::Format value = vk::Format::eR32G32B32Sfloat;
+};
+template <> struct vertex_format<std::array<float, 4>>
+{
+    static constexpr vk::Format value = vk::Format::eR32G32B32A32Sfloat;
+};
+template <> struct vertex_format<uint32_t>
+{
+    static constexpr vk::Format value = vk::Format::eR32Uint;
+};
+
+struct vertex_attribute
+{
+    uint32_t location;
+    vk::Format format;
+    uint32_t offset;
+};
+
+/*
+ * Specialize for every struct that is fed to the pipeline as one vertex stream (binding), listing its
+ * members with VK_UTILS_VERTEX_ATTRIBUTE:
+ *
+ *  template <> struct vertex_attributes<my_vertex>
+ *  {
+ *      static constexpr std::array value = {VK_UTILS_VERTEX_ATTRIBUTE (my_vertex, position, 0)};
+ *  };
+ *
+ * Formats and offsets come from the members themselves, so changing the struct changes the pipeline.
+ */
+template <typename vertex_type> struct vertex_attributes;
+
+// Streams advance per vertex unless specialized, per-instance data sets this to eInstance
+template <typename vertex_type> struct vertex_input_rate
+{
+    static constexpr vk::VertexInputRate value = vk::VertexInputRate::eVertex;
+};
+
+#define VK_UTILS_VERTEX_ATTRIBUTE(vertex_type, member, location)                                                   \
+    ::graphics::vk_utils::vertex_attribute                                                                         \
+    {                                                                                                              \
+        location, ::graphics::vk_utils::vertex_format<decltype (vertex_type::member)>::value,                     \
+            static_cast<uint32_t> (offsetof (vertex_type, member))                                                 \
+    }
+
+namespace detail
+{
+
+// stream i of a vertex input is bound at binding i
+template <typename... stream_types, std::size_t... indices>
+constexpr std::array<vk::VertexInputBindingDescription, sizeof...(stream_types)>
+make_bindings (std::index_sequence<indices...>)
+{
+    return {vk::VertexInputBindingDescription {static_cast<uint32_t> (indices),
+                                               static_cast<uint32_t> (sizeof (stream_types)),
+                                               vertex_input_rate<stream_types>::value}...};
+}
+
+template <std::size_t count, typename... stream_types, std::size_t... indices>
+constexpr std::array<vk::VertexInputAttributeDescription, count> make_attributes (std::index_sequence<indices...>)
+{
+    std::array<vk::VertexInputAttributeDescription, count> result {};
+    std::size_t next = 0;
+
+    auto append = [&result, &next] (uint32_t binding, const auto &stream_attributes) {
+        for ( const vertex_attribute &attribute : stream_attributes )
+        {
+            result[next].location = attribute.location;
+            result[next].binding  = binding;
+            result[next].format   = attribute.format;
+            result[next].offset   = attribute.offset;
+            ++next;
+        }
+    };
+    (append (static_cast<uint32_t> (indices), vertex_attributes<stream_types>::value), ...);
+    return result;
+}
+
+template <std::size_t count>
+constexpr bool unique_locations (const std::array<vk::VertexInputAttributeDescription, count> &attributes)
+{
+    for ( std::size_t i = 0; i < count; ++i )
+        for ( std::size_t j = i + 1; j < count; ++j )
+            if ( attributes[i].location == attributes[j].location )
+                return false;
+    return true;
+}
+
+}   // namespace detail
+
+/*
+ * Vertex input state for a set of streams, stream i is bound at binding i. A single stream is the interleaved
+ * layout, several give split streams, e.g. positions apart from everything else so that depth-only passes
+ * fetch only the data they need.
+ */
+template <typename... stream_types> struct vertex_input
+{
+    static constexpr uint32_t binding_count   = sizeof...(stream_types);
+    static constexpr uint32_t attribute_count = (0 + ... + vertex_attributes<stream_types>::value.size ());
+
+    static constexpr std::array<vk::VertexInputBindingDescription, binding_count> bindings =
+        detail::make_bindings<stream_types...> (std::index_sequence_for<stream_types...> {});
+    static constexpr std::array<vk::VertexInputAttributeDescription, attribute_count> attributes =
+        detail::make_attributes<attribute_count, stream_types...> (std::index_sequence_for<stream_types...> {});
+
+    static_assert (binding_count > 0, "A vertex input needs at least one stream");
+    static_assert (detail::unique_locations (attributes), "Two vertex attributes share a location");
+
+    // The returned structure points into static storage, it may be copied around freely
+    static vk::PipelineVertexInputStateCreateInfo state_info ()
+    {
+        vk::PipelineVertexInputStateCreateInfo vertex_input_info {};
+        vertex_input_info.flags                           = vk::PipelineVertexInputStateCreateFlags ();
+        vertex_input_info.vertexBindingDescriptionCount   = binding_count;
+        vertex_input_info.pVertexBindingDescriptions      = bindings.data ();
+        vertex_input_info.vertexAttributeDescriptionCount = attribute_count;
+        vertex_input_info.pVertexAttributeDescriptions    = attributes.data ();
+        return vertex_input_info;
+    }
+};
+
+}   // namespace vk_utils
+}   // namespace graphics
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace graphics
+{
+namespace vk_utils
+{
+
+// Fixed set of threads pulling jobs from one queue, joined on destruction
+struct worker_pool
+{
+    worker_pool (unsigned thread_count = default_thread_count ())
+    {
+        m_threads.reserve (thread_count);
+        for ( unsigned i = 0; i < thread_count; ++i )
+            m_threads.emplace_back ([this] { work (); });
+    }
+
+    worker_pool (const worker_pool &)             = delete;
+    worker_pool &operator= (const worker_pool &) = delete;
+
+    ~worker_pool ()
+    {
+        {
+            std::lock_guard<std::mutex> lock {m_mutex};
+            m_stopping = true;
+        }
+        m_job_added.notify_all ();
+
+        for ( auto &thread : m_threads )
+            thread.join ();
+    }
+
+    void submit (std::function<void ()> job)
+    {
+        {
+            std::lock_guard<std::mutex> lock {m_mutex};
+            m_jobs.push_back (std::move (job));
+        }
+        m_job_added.notify_one ();
+    }
+
+    // Blocks until every submitted job has finished
+    void wait_idle ()
+    {
+        std::unique_lock<std::mutex> lock {m_mutex};
+        m_idle.wait (lock, [this] { return m_jobs.empty () && !m_busy; });
+    }
+
+    std::size_t size () const { return m_threads.size (); }
+
+    // leave one core to the render loop, hardware_concurrency () may also report 0 when it doesn't know
+    static unsigned default_thread_count () { return std::max (2u, std::thread::hardware_concurrency ()) - 1; }
+
+  private:
+    std::mutex m_mutex;
+    std::condition_variable m_job_added;
+    std::condition_variable m_idle;
+    std::deque<std::function<void ()>> m_jobs;
+    std::vector<std::thread> m_threads;
+    unsigned m_busy = 0;
+    bool m_stopping = false;
+
+    void work ()
+    {
+        for ( ;; )
+        {
+            std::function<void ()> job;
+            {
+                std::unique_lock<std::mutex> lock {m_mutex};
+                m_job_added.wait (lock, [this] { return m_stopping || !m_jobs.empty (); });
+                if ( m_jobs.empty () )
+                    return;
+
+                job = std::move (m_jobs.front ());
+                m_jobs.pop_front ();
+                ++m_busy;
+            }
+
+            job ();
+
+            {
+                std::lock_guard<std::mutex> lock {m_mutex};
+                --m_busy;
+                if ( m_jobs.empty () && !m_busy )
+                    m_idle.notify_all ();
+            }
+        }
+    }
+};
+
+}   // namespace vk_utils
+}   // namespace graphics